@@ -0,0 +1,749 @@
+/**
+@file bench
+@author Ethan Browne, efbrowne
+Benchmarks for the map and value components.  Run as bench <name>, where the
+name picks which benchmark to run.  With --perf-counters after the name, the
+lookup loops in the front, batch, bloom and layout benchmarks also report
+cycles, cache misses and so on per lookup.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "value.h"
+#include "map.h"
+#include "mapVariants.h"
+#include "zipf.h"
+#include "counters.h"
+
+/** Number of distinct keys used by the cache benchmark. */
+#define CACHE_KEYS 100000
+
+/** Number of operations in the cache benchmark. */
+#define CACHE_OPS 2000000
+
+/** Number of keys used by the alphabet variant benchmark. */
+#define VARIANT_KEYS 200000
+
+/** Number of lookups in the alphabet variant benchmark. */
+#define VARIANT_OPS 2000000
+
+/** Number of keys used by the front cache benchmark. */
+#define FRONT_KEYS 100000
+
+/** Number of lookups in the front cache benchmark. */
+#define FRONT_OPS 4000000
+
+/** Number of values converted by the formatting benchmark. */
+#define FORMAT_VALUES 1000000
+
+/** Number of values created by the allocation benchmark. */
+#define ALLOC_VALUES 2000000
+
+/** Number of keys used by the allocation benchmark's set and plus loop. */
+#define ALLOC_KEYS 1000
+
+/** Number of keys in the batched lookup benchmark, enough that the map is
+    much larger than the last-level cache. */
+#define BATCH_KEYS 60000
+
+/** Length of the keys in the batched lookup benchmark. */
+#define BATCH_KEY_LENGTH 12
+
+/** Number of lookups in the batched lookup benchmark. */
+#define BATCH_OPS 2000000
+
+/** Number of keys under the removed prefix in the prefix benchmark. */
+#define PREFIX_KEYS 200000
+
+/** Number of keys in the Bloom filter benchmark. */
+#define BLOOM_KEYS 100000
+
+/** Number of lookups timed for each Bloom filter setting. */
+#define BLOOM_OPS 2000000
+
+/** Number of keys in the layout benchmark. */
+#define LAYOUT_KEYS 60000
+
+/** Number of lookups timed before and after the layout pass. */
+#define LAYOUT_OPS 2000000
+
+/** Zipf exponent for skewed key popularity. */
+#define ZIPF_S 0.99
+
+/** Longest key generated by the benchmarks. */
+#define KEY_LENGTH 64
+
+/** Counters for the benchmark loops. */
+static Counters counters;
+
+/** True if the benchmark loops are being counted. */
+static bool counting;
+
+/**
+Reads the counters at the start of a benchmark loop, if they're being counted
+@param start filled in with the counts
+*/
+static void startLoop( CounterSample *start )
+{
+  if ( counting )
+    readCounters( &counters, start );
+}
+
+/**
+Prints a line of counts per operation for a benchmark loop, if the loops are
+being counted
+@param name name of the loop, at most 8 characters
+@param start counts from the start of the loop
+@param ops number of operations the loop did
+*/
+static void endLoop( char const *name, CounterSample const *start, long ops )
+{
+  if ( !counting )
+    return;
+  CounterTotals t;
+  initTotals( &t );
+  endRegion( &counters, start, &t, ops );
+  reportCounters( stdout, name, &t );
+}
+
+/**
+Draws a rank from the given Zipf distribution, using rand()
+@param z the distribution
+@return the rank, with 0 the most popular
+*/
+static int drawZipf( Zipf const *z )
+{
+  return nextZipf( z, rand() / ( RAND_MAX + 1.0 ) );
+}
+
+/**
+Returns the current time in seconds, from a monotonic clock
+@return the time
+*/
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+Writes the key for the given rank into a buffer
+@param buffer the buffer, at least KEY_LENGTH + 1 bytes
+@param rank the rank of the key
+*/
+static void makeKey( char *buffer, int rank )
+{
+  sprintf( buffer, "user:%d", rank );
+}
+
+/**
+Uses a size-limited map as a read-through cache for a Zipf workload at
+several memory budgets, reporting the hit ratio and throughput of each.
+*/
+static void benchCache()
+{
+  Zipf z = makeZipf( CACHE_KEYS, ZIPF_S );
+  int *ranks = (int *) malloc( CACHE_OPS * sizeof( int ) );
+  for ( int i = 0; i < CACHE_OPS; i++ )
+    ranks[ i ] = drawZipf( &z );
+
+  // Measure how much room every key would need.
+  Map *full = makeMap();
+  char key[ KEY_LENGTH + 1 ];
+  for ( int i = 0; i < CACHE_KEYS; i++ ) {
+    makeKey( key, i );
+    mapSet( full, key, parseInteger( "1" ) );
+  }
+  size_t needed = mapBytes( full );
+  freeMap( full );
+  printf( "cache: %d keys need %zu bytes\n", CACHE_KEYS, needed );
+
+  double fractions[] = { 0.01, 0.05, 0.1, 0.25, 0.5, 1.0 };
+  for ( int f = 0; f < sizeof( fractions ) / sizeof( fractions[ 0 ] ); f++ ) {
+    size_t limit = needed * fractions[ f ];
+    Map *m = makeMapWithLimit( limit );
+    long hits = 0;
+    double start = now();
+    for ( int i = 0; i < CACHE_OPS; i++ ) {
+      makeKey( key, ranks[ i ] );
+      if ( mapGet( m, key ) != NULL )
+        hits++;
+      else
+        mapSet( m, key, parseInteger( "1" ) );
+    }
+    double elapsed = now() - start;
+    printf( "  budget %5.1f%% (%10zu bytes): hit ratio %.3f, %.2f Mops/s, %d keys cached\n",
+            fractions[ f ] * 100, limit, (double) hits / CACHE_OPS,
+            CACHE_OPS / elapsed / 1e6, mapSize( m ) );
+    freeMap( m );
+  }
+
+  free( ranks );
+  freeZipf( &z );
+}
+
+/**
+Compares lookups in the general map against the lowercase-only variant, using
+random lowercase keys.
+*/
+static void benchVariants()
+{
+  char (*keys)[ KEY_LENGTH + 1 ] = malloc( VARIANT_KEYS * sizeof( *keys ) );
+  for ( int i = 0; i < VARIANT_KEYS; i++ ) {
+    int len = 8 + rand() % 8;
+    for ( int j = 0; j < len; j++ )
+      keys[ i ][ j ] = 'a' + rand() % 26;
+    keys[ i ][ len ] = '\0';
+  }
+  int *order = (int *) malloc( VARIANT_OPS * sizeof( int ) );
+  for ( int i = 0; i < VARIANT_OPS; i++ )
+    order[ i ] = rand() % VARIANT_KEYS;
+
+  Map *m = makeMap();
+  MapLower *lm = makeMapLower();
+  for ( int i = 0; i < VARIANT_KEYS; i++ ) {
+    mapSet( m, keys[ i ], parseInteger( "1" ) );
+    mapSetLower( lm, keys[ i ], parseInteger( "1" ) );
+  }
+
+  double start = now();
+  for ( int i = 0; i < VARIANT_OPS; i++ )
+    mapGet( m, keys[ order[ i ] ] );
+  double general = now() - start;
+
+  start = now();
+  for ( int i = 0; i < VARIANT_OPS; i++ )
+    mapGetLower( lm, keys[ order[ i ] ] );
+  double lower = now() - start;
+
+  printf( "variants: %d keys, general map %zu bytes\n", VARIANT_KEYS, mapBytes( m ) );
+  printf( "  general map: %.2f Mlookups/s\n", VARIANT_OPS / general / 1e6 );
+  printf( "  lowercase map: %.2f Mlookups/s\n", VARIANT_OPS / lower / 1e6 );
+
+  freeMap( m );
+  freeMapLower( lm );
+  free( order );
+  free( keys );
+}
+
+/**
+Measures mapGet() on a Zipf workload of long keys, with and without front
+caches of a few sizes.
+*/
+static void benchFront()
+{
+  char (*keys)[ KEY_LENGTH + 1 ] = malloc( FRONT_KEYS * sizeof( *keys ) );
+  for ( int i = 0; i < FRONT_KEYS; i++ )
+    sprintf( keys[ i ], "tenant-%08d/service-%08d/metric-%022d", i % 97, i % 1009, i );
+
+  Zipf z = makeZipf( FRONT_KEYS, ZIPF_S );
+  int *ranks = (int *) malloc( FRONT_OPS * sizeof( int ) );
+  for ( int i = 0; i < FRONT_OPS; i++ )
+    ranks[ i ] = drawZipf( &z );
+
+  Map *m = makeMap();
+  for ( int i = 0; i < FRONT_KEYS; i++ )
+    mapSet( m, keys[ i ], parseInteger( "1" ) );
+
+  printf( "front: %d keys of %zu characters, Zipf %.2f\n", FRONT_KEYS,
+          strlen( keys[ 0 ] ), ZIPF_S );
+  int sizes[] = { 0, 256, 1024, 4096, 16384 };
+  for ( int c = 0; c < sizeof( sizes ) / sizeof( sizes[ 0 ] ); c++ ) {
+    if ( sizes[ c ] > 0 )
+      mapEnableFrontCache( m, sizes[ c ] );
+    CounterSample counts;
+    startLoop( &counts );
+    double start = now();
+    for ( int i = 0; i < FRONT_OPS; i++ )
+      mapGet( m, keys[ ranks[ i ] ] );
+    double elapsed = now() - start;
+
+    long hits = 0, misses = 0;
+    mapFrontCacheStats( m, &hits, &misses );
+    printf( "  %5d entries: %.2f Mlookups/s, hit ratio %.3f\n", sizes[ c ],
+            FRONT_OPS / elapsed / 1e6,
+            hits + misses > 0 ? (double) hits / ( hits + misses ) : 0.0 );
+    char name[ KEY_LENGTH + 1 ];
+    sprintf( name, "front%d", sizes[ c ] );
+    endLoop( name, &counts, FRONT_OPS );
+    mapDisableFrontCache( m );
+  }
+
+  freeMap( m );
+  free( ranks );
+  freeZipf( &z );
+  free( keys );
+}
+
+/**
+Compares the value formatting routines against the printf conversions they
+replace, on random integers and doubles.
+*/
+static void benchFormat()
+{
+  int *ints = (int *) malloc( FORMAT_VALUES * sizeof( int ) );
+  double *doubles = (double *) malloc( FORMAT_VALUES * sizeof( double ) );
+  for ( int i = 0; i < FORMAT_VALUES; i++ ) {
+    ints[ i ] = rand() - RAND_MAX / 2;
+    doubles[ i ] = ( rand() - RAND_MAX / 2 ) / 1000.0 + rand() / ( RAND_MAX + 1.0 );
+  }
+
+  // Add up the lengths, so the conversions can't be optimized away.
+  char buffer[ DOUBLE_LENGTH + 1 ];
+  long total = 0;
+  double start = now();
+  for ( int i = 0; i < FORMAT_VALUES; i++ )
+    total += sprintf( buffer, "%d", ints[ i ] );
+  double printfInt = now() - start;
+
+  start = now();
+  for ( int i = 0; i < FORMAT_VALUES; i++ )
+    total += formatInteger( ints[ i ], buffer );
+  double fastInt = now() - start;
+
+  start = now();
+  for ( int i = 0; i < FORMAT_VALUES; i++ )
+    total += sprintf( buffer, "%f", doubles[ i ] );
+  double printfFixed = now() - start;
+
+  setDoubleFormat( DOUBLE_FIXED );
+  start = now();
+  for ( int i = 0; i < FORMAT_VALUES; i++ )
+    total += formatDouble( doubles[ i ], buffer );
+  double fastFixed = now() - start;
+
+  start = now();
+  for ( int i = 0; i < FORMAT_VALUES; i++ )
+    total += sprintf( buffer, "%.17g", doubles[ i ] );
+  double printfShortest = now() - start;
+
+  setDoubleFormat( DOUBLE_SHORTEST );
+  start = now();
+  for ( int i = 0; i < FORMAT_VALUES; i++ )
+    total += formatDouble( doubles[ i ], buffer );
+  double fastShortest = now() - start;
+  setDoubleFormat( DOUBLE_FIXED );
+
+  printf( "format: %d values (%ld characters)\n", FORMAT_VALUES, total );
+  printf( "  integer   %%d: %6.1f ns   formatInteger: %6.1f ns\n",
+          printfInt / FORMAT_VALUES * 1e9, fastInt / FORMAT_VALUES * 1e9 );
+  printf( "  fixed     %%f: %6.1f ns   formatDouble:  %6.1f ns\n",
+          printfFixed / FORMAT_VALUES * 1e9, fastFixed / FORMAT_VALUES * 1e9 );
+  printf( "  shortest %%.17g: %6.1f ns   formatDouble:  %6.1f ns\n",
+          printfShortest / FORMAT_VALUES * 1e9, fastShortest / FORMAT_VALUES * 1e9 );
+
+  free( ints );
+  free( doubles );
+}
+
+/**
+Measures creating and destroying values, alone and through set and plus on a
+map, then reports the occupancy of the value pools.  Build with -DPOOL_MALLOC
+to compare against plain malloc().
+*/
+static void benchAlloc()
+{
+  double start = now();
+  for ( int i = 0; i < ALLOC_VALUES; i++ ) {
+    Value *v = parseInteger( "42" );
+    v->destroy( v );
+  }
+  double integers = now() - start;
+
+  start = now();
+  for ( int i = 0; i < ALLOC_VALUES; i++ ) {
+    Value *v = parseString( "\"pooled\"" );
+    v->destroy( v );
+  }
+  double strings = now() - start;
+
+  // Copying doesn't parse anything, so it's mostly allocation.
+  Value *orig = parseDouble( "2.5" );
+  start = now();
+  for ( int i = 0; i < ALLOC_VALUES; i++ ) {
+    Value *v = copyValue( orig );
+    v->destroy( v );
+  }
+  double copies = now() - start;
+  orig->destroy( orig );
+
+  // Each plus makes and destroys a temporary, and each set replaces a value.
+  Map *m = makeMap();
+  char key[ KEY_LENGTH + 1 ];
+  start = now();
+  for ( int i = 0; i < ALLOC_VALUES; i++ ) {
+    makeKey( key, i % ALLOC_KEYS );
+    if ( i % 4 == 0 )
+      mapSet( m, key, parseInteger( "1" ) );
+    else {
+      Value *x = parseInteger( "1" );
+      if ( mapGet( m, key ) != NULL )
+        mapPlus( m, key, x );
+      x->destroy( x );
+    }
+  }
+  double setPlus = now() - start;
+
+#ifdef POOL_MALLOC
+  printf( "alloc: %d values each, malloc\n", ALLOC_VALUES );
+#else
+  printf( "alloc: %d values each, pools\n", ALLOC_VALUES );
+#endif
+  printf( "  parseInteger + destroy: %6.1f ns\n", integers / ALLOC_VALUES * 1e9 );
+  printf( "  parseString + destroy:  %6.1f ns\n", strings / ALLOC_VALUES * 1e9 );
+  printf( "  copyValue + destroy:    %6.1f ns\n", copies / ALLOC_VALUES * 1e9 );
+  printf( "  set/plus mix:           %6.1f ns\n", setPlus / ALLOC_VALUES * 1e9 );
+
+  PoolStats stats[ VALUE_POOLS ];
+  valuePoolStats( stats );
+  for ( int i = 0; i < VALUE_POOLS; i++ )
+    printf( "  %-8s pool: %ld live of %ld in %ld slabs, %ld in depot\n", stats[ i ].name,
+            stats[ i ].live, stats[ i ].capacity, stats[ i ].slabs, stats[ i ].depot );
+  freeMap( m );
+}
+
+/**
+Fills a buffer with a random key of BATCH_KEY_LENGTH characters
+@param key the buffer
+*/
+static void randomKey( char *key )
+{
+  char const digits[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  for ( int j = 0; j < BATCH_KEY_LENGTH; j++ )
+    key[ j ] = digits[ rand() % ( sizeof( digits ) - 1 ) ];
+  key[ BATCH_KEY_LENGTH ] = '\0';
+}
+
+/**
+Compares a loop of mapGet() against mapGetBatch() with a few batch sizes, on
+random keys in a map much larger than the last-level cache.
+*/
+static void benchBatch()
+{
+  char (*keys)[ BATCH_KEY_LENGTH + 1 ] = malloc( BATCH_KEYS * sizeof( *keys ) );
+  Map *m = makeMap();
+  for ( int i = 0; i < BATCH_KEYS; i++ ) {
+    randomKey( keys[ i ] );
+    mapSet( m, keys[ i ], parseInteger( "1" ) );
+  }
+  char const **order = (char const **) malloc( BATCH_OPS * sizeof( char const * ) );
+  for ( int i = 0; i < BATCH_OPS; i++ )
+    order[ i ] = keys[ rand() % BATCH_KEYS ];
+  Value **out = (Value **) malloc( BATCH_OPS * sizeof( Value * ) );
+
+  printf( "batch: %d keys of %d characters, map %zu MB\n", BATCH_KEYS, BATCH_KEY_LENGTH,
+          mapBytes( m ) >> 20 );
+  CounterSample counts;
+  startLoop( &counts );
+  double start = now();
+  for ( int i = 0; i < BATCH_OPS; i++ )
+    out[ i ] = mapGet( m, order[ i ] );
+  double single = now() - start;
+  printf( "  mapGet loop:        %6.1f ns/lookup\n", single / BATCH_OPS * 1e9 );
+  endLoop( "mapGet", &counts, BATCH_OPS );
+
+  int sizes[] = { 4, 16, 64, 1024 };
+  for ( int b = 0; b < sizeof( sizes ) / sizeof( sizes[ 0 ] ); b++ ) {
+    startLoop( &counts );
+    start = now();
+    for ( int i = 0; i < BATCH_OPS; i += sizes[ b ] ) {
+      int n = BATCH_OPS - i < sizes[ b ] ? BATCH_OPS - i : sizes[ b ];
+      mapGetBatch( m, order + i, n, out + i );
+    }
+    double batched = now() - start;
+    printf( "  mapGetBatch of %4d: %6.1f ns/lookup (%.2fx)\n", sizes[ b ],
+            batched / BATCH_OPS * 1e9, single / batched );
+    char name[ KEY_LENGTH + 1 ];
+    sprintf( name, "batch%d", sizes[ b ] );
+    endLoop( name, &counts, BATCH_OPS );
+  }
+
+  freeMap( m );
+  free( out );
+  free( order );
+  free( keys );
+}
+
+/**
+Fills a map with keys for one tenant, plus a key for another tenant
+@param background true if the map should free removed keys in the background
+@return the map
+*/
+static Map *makeTenantMap( bool background )
+{
+  Map *m = makeMap();
+  mapFreeInBackground( m, background );
+  char key[ KEY_LENGTH + 1 ];
+  for ( int i = 0; i < PREFIX_KEYS; i++ ) {
+    sprintf( key, "tenant7:%07d", i );
+    mapSet( m, key, parseInteger( "1" ) );
+  }
+  mapSet( m, "tenant8:0", parseInteger( "1" ) );
+  return m;
+}
+
+/**
+Compares removing all of a tenant's keys one at a time against removing them
+with mapRemovePrefix(), freeing right away and in the background.
+*/
+static void benchPrefix()
+{
+  Map *m = makeTenantMap( false );
+  printf( "prefix: %d keys under one prefix, map %zu MB\n", PREFIX_KEYS, mapBytes( m ) >> 20 );
+  char key[ KEY_LENGTH + 1 ];
+  double start = now();
+  for ( int i = 0; i < PREFIX_KEYS; i++ ) {
+    sprintf( key, "tenant7:%07d", i );
+    mapRemove( m, key );
+  }
+  printf( "  mapRemove loop:             %8.2f ms\n", ( now() - start ) * 1e3 );
+  freeMap( m );
+
+  m = makeTenantMap( false );
+  start = now();
+  mapRemovePrefix( m, "tenant7:" );
+  printf( "  mapRemovePrefix:            %8.2f ms\n", ( now() - start ) * 1e3 );
+  freeMap( m );
+
+  m = makeTenantMap( true );
+  start = now();
+  mapRemovePrefix( m, "tenant7:" );
+  printf( "  mapRemovePrefix, background: %7.3f ms to return\n", ( now() - start ) * 1e3 );
+  freeMap( m );
+}
+
+/**
+Writes the key used by the Bloom filter benchmark for a number.  Keys share
+long prefixes, so a lookup for a missing key walks most of the way down the
+trie before it fails.
+@param buffer the buffer, at least KEY_LENGTH + 1 bytes
+@param i the number
+*/
+static void bloomKey( char *buffer, int i )
+{
+  sprintf( buffer, "tenant-%04d/service-%06d/metric-%016d", i % 97, i % 1009, i );
+}
+
+/**
+Times lookups for keys that are in the map and keys that aren't
+@param m the map
+@param keys keys to look up, BLOOM_OPS of them
+@param name name of the loop, for its counts
+@return nanoseconds per lookup
+*/
+static double timeLookups( Map *m, char (*keys)[ KEY_LENGTH + 1 ], char const *name )
+{
+  CounterSample counts;
+  startLoop( &counts );
+  double start = now();
+  for ( int i = 0; i < BLOOM_OPS; i++ )
+    mapGet( m, keys[ i ] );
+  double ns = ( now() - start ) * 1e9 / BLOOM_OPS;
+  endLoop( name, &counts, BLOOM_OPS );
+  return ns;
+}
+
+/**
+Replaces every other key in the Bloom filter benchmark's map with a new one
+@param m the map
+@param from multiple of BLOOM_KEYS the replaced keys start at
+@param to multiple of BLOOM_KEYS the new keys start at
+@return seconds taken
+*/
+static double churnKeys( Map *m, int from, int to )
+{
+  char key[ KEY_LENGTH + 1 ];
+  double start = now();
+  for ( int i = 0; i < BLOOM_KEYS; i += 2 ) {
+    bloomKey( key, from * BLOOM_KEYS + i );
+    mapRemove( m, key );
+    bloomKey( key, to * BLOOM_KEYS + i );
+    mapSet( m, key, parseInteger( "1" ) );
+  }
+  return now() - start;
+}
+
+/**
+Compares lookups with and without a Bloom filter, for keys that are in the
+map and keys that aren't, then churns the keys to show the filter being
+rebuilt.
+*/
+static void benchBloom()
+{
+  char (*hits)[ KEY_LENGTH + 1 ] = malloc( BLOOM_OPS * sizeof( *hits ) );
+  char (*misses)[ KEY_LENGTH + 1 ] = malloc( BLOOM_OPS * sizeof( *misses ) );
+  for ( int i = 0; i < BLOOM_OPS; i++ ) {
+    bloomKey( hits[ i ], rand() % BLOOM_KEYS );
+    bloomKey( misses[ i ], BLOOM_KEYS + rand() % BLOOM_KEYS );
+  }
+
+  Map *m = makeMap();
+  char key[ KEY_LENGTH + 1 ];
+  for ( int i = 0; i < BLOOM_KEYS; i++ ) {
+    bloomKey( key, i );
+    mapSet( m, key, parseInteger( "1" ) );
+  }
+  size_t bytes = mapBytes( m );
+  printf( "bloom: %d keys of %zu characters, map %zu MB\n", BLOOM_KEYS, strlen( key ),
+          bytes >> 20 );
+
+  int bits[] = { 0, 8, 10, 16 };
+  for ( int b = 0; b < sizeof( bits ) / sizeof( bits[ 0 ] ); b++ ) {
+    if ( bits[ b ] > 0 )
+      mapEnableBloomFilter( m, bits[ b ] );
+    char name[ KEY_LENGTH + 1 ];
+    sprintf( name, "miss%d", bits[ b ] );
+    double miss = timeLookups( m, misses, name );
+    sprintf( name, "hit%d", bits[ b ] );
+    double hit = timeLookups( m, hits, name );
+    BloomStats stats = { 0, 0, 0, 0, 0, 0, 0, false };
+    if ( bits[ b ] > 0 )
+      mapBloomFilterStats( m, &stats );
+    printf( "  %2d bits/key: miss %6.1f ns, hit %6.1f ns, filter %5zu KB (%.2f%% of map),"
+            " false positives %.3f%%\n", bits[ b ], miss, hit, stats.bytes >> 10,
+            stats.bytes * 100.0 / bytes, stats.falsePositives * 100.0 / BLOOM_OPS );
+    mapDisableBloomFilter( m );
+  }
+
+  // Replace half the keys with new ones, a few times over, without a filter
+  // and then with one, so the filter fills up with removed keys and has to
+  // be rebuilt.
+  double plain = churnKeys( m, 0, 2 ) + churnKeys( m, 2, 3 );
+  mapEnableBloomFilter( m, 10 );
+  double churn = churnKeys( m, 3, 4 ) + churnKeys( m, 4, 5 ) + churnKeys( m, 5, 6 );
+  BloomStats stats;
+  mapBloomFilterStats( m, &stats );
+  while ( stats.rebuilding )
+    mapBloomFilterStats( m, &stats );
+  long before = stats.falsePositives;
+  double miss = timeLookups( m, misses, "churned" );
+  mapBloomFilterStats( m, &stats );
+  printf( "  churn: %.1f ns per remove and set without a filter, %.1f ns with 10 bits/key\n",
+          plain * 1e9 / BLOOM_KEYS, churn * 2e9 / ( 3 * BLOOM_KEYS ) );
+  printf( "  after churn: %ld rebuilds, miss %.1f ns, false positives %.3f%%\n",
+          stats.rebuilds, miss,
+          ( stats.falsePositives - before ) * 100.0 / BLOOM_OPS );
+
+  freeMap( m );
+  free( hits );
+  free( misses );
+}
+
+/**
+Returns how much of the process's memory is backed by transparent huge pages
+@return kilobytes in huge pages, or -1 if the system doesn't say
+*/
+static long hugePageKB()
+{
+  FILE *fp = fopen( "/proc/self/smaps_rollup", "r" );
+  if ( fp == NULL )
+    return -1;
+  char line[ 128 ];
+  long kb = -1;
+  while ( fgets( line, sizeof( line ), fp ) )
+    if ( sscanf( line, "AnonHugePages: %ld", &kb ) == 1 )
+      break;
+  fclose( fp );
+  return kb;
+}
+
+/**
+Times random lookups in a map whose nodes were allocated one at a time and
+then churned, before and after mapOptimizeLayout() packs them into chunks.
+*/
+static void benchLayout()
+{
+  char (*keys)[ BATCH_KEY_LENGTH + 1 ] = malloc( LAYOUT_KEYS * sizeof( *keys ) );
+  Map *m = makeMap();
+  for ( int i = 0; i < LAYOUT_KEYS; i++ ) {
+    randomKey( keys[ i ] );
+    mapSet( m, keys[ i ], parseInteger( "1" ) );
+  }
+
+  // Replace half the keys, so new nodes land in the holes the old ones
+  // left all over the heap.
+  for ( int i = 0; i < LAYOUT_KEYS; i += 2 ) {
+    mapRemove( m, keys[ i ] );
+    randomKey( keys[ i ] );
+    mapSet( m, keys[ i ], parseInteger( "1" ) );
+  }
+  char const **order = (char const **) malloc( LAYOUT_OPS * sizeof( char const * ) );
+  for ( int i = 0; i < LAYOUT_OPS; i++ )
+    order[ i ] = keys[ rand() % LAYOUT_KEYS ];
+
+  printf( "layout: %d keys of %d characters, map %zu MB\n", LAYOUT_KEYS, BATCH_KEY_LENGTH,
+          mapBytes( m ) >> 20 );
+  for ( int pass = 0; pass < 2; pass++ ) {
+    if ( pass == 1 ) {
+      double start = now();
+      int moved = mapOptimizeLayout( m );
+      printf( "  mapOptimizeLayout: %d nodes in %.1f ms\n", moved, ( now() - start ) * 1e3 );
+    }
+    CounterSample counts;
+    startLoop( &counts );
+    double start = now();
+    for ( int i = 0; i < LAYOUT_OPS; i++ )
+      mapGet( m, order[ i ] );
+    printf( "  %-9s lookups %6.1f ns, huge pages %ld MB\n", pass ? "packed" : "scattered",
+            ( now() - start ) / LAYOUT_OPS * 1e9, hugePageKB() >> 10 );
+    endLoop( pass ? "packed" : "scatter", &counts, LAYOUT_OPS );
+  }
+
+  freeMap( m );
+  free( order );
+  free( keys );
+}
+
+/**
+Runs the benchmark named on the command line
+@param argc number of command-line arguments
+@param argv the command-line arguments
+@return exit status of the program
+*/
+int main( int argc, char *argv[] )
+{
+  if ( argc != 2 && ( argc != 3 || strcmp( argv[ 2 ], "--perf-counters" ) != 0 ) ) {
+    fprintf( stderr, "usage: bench cache|variants|front|format|alloc|batch|prefix|bloom|layout"
+             " [--perf-counters]\n" );
+    return EXIT_FAILURE;
+  }
+  if ( argc == 3 ) {
+    counting = openCounters( &counters );
+    if ( counting )
+      counterHeader( stdout );
+    else
+      fprintf( stderr, "perf counters unavailable: %s\n", strerror( counters.error ) );
+  }
+
+  if ( strcmp( argv[ 1 ], "cache" ) == 0 )
+    benchCache();
+  else if ( strcmp( argv[ 1 ], "variants" ) == 0 )
+    benchVariants();
+  else if ( strcmp( argv[ 1 ], "front" ) == 0 )
+    benchFront();
+  else if ( strcmp( argv[ 1 ], "format" ) == 0 )
+    benchFormat();
+  else if ( strcmp( argv[ 1 ], "alloc" ) == 0 )
+    benchAlloc();
+  else if ( strcmp( argv[ 1 ], "batch" ) == 0 )
+    benchBatch();
+  else if ( strcmp( argv[ 1 ], "prefix" ) == 0 )
+    benchPrefix();
+  else if ( strcmp( argv[ 1 ], "bloom" ) == 0 )
+    benchBloom();
+  else if ( strcmp( argv[ 1 ], "layout" ) == 0 )
+    benchLayout();
+  else {
+    fprintf( stderr, "unknown benchmark: %s\n", argv[ 1 ] );
+    return EXIT_FAILURE;
+  }
+  if ( counting )
+    closeCounters( &counters );
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/**
+@file command
+@author Ethan Browne, efbrowne
+Parses and runs the driver's commands against a map, collecting their output
+in a buffer so the caller decides when and how it's written.
+*/
+
+#include "command.h"
+#include "value.h"
+#include "dump.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Starting capacity for an output buffer. */
+#define INITIAL_OUTPUT 64
+
+/**
+Initialize an empty output buffer
+@param out buffer to initialize
+*/
+void initOutput( Output *out )
+{
+    out->len = 0;
+    out->cap = INITIAL_OUTPUT;
+    out->text = (char *) malloc( out->cap );
+}
+
+/**
+Add characters to the end of an output buffer, growing it as needed
+@param out buffer to add to
+@param str characters to add
+@param len number of characters to add
+*/
+void appendOutput( Output *out, char const *str, int len )
+{
+    if (out->len + len > out->cap) {
+        while (out->len + len > out->cap) {
+            out->cap *= 2;
+        }
+        out->text = (char *) realloc( out->text, out->cap );
+    }
+    memcpy(out->text + out->len, str, len);
+    out->len += len;
+}
+
+/**
+Free the memory used by an output buffer
+@param out buffer to free
+*/
+void freeOutput( Output *out )
+{
+    free(out->text);
+    out->text = NULL;
+    out->len = out->cap = 0;
+}
+
+/**
+Adds a line of text to the output buffer
+@param out buffer to add to
+@param str the line, without its newline
+*/
+static void outputLine( Output *out, char const *str )
+{
+    appendOutput(out, str, strlen(str));
+    appendOutput(out, "\n", 1);
+}
+
+/**
+Parses a value the way the set and plus commands expect, trying an integer,
+then a double, then a string
+@param str text of the value
+@return the new value, or NULL if str isn't a valid value
+*/
+static Value *parseValue( char const *str )
+{
+    // Nothing but spaces isn't a value, and parseString() can't handle it.
+    char first[2];
+    if (sscanf(str, "%1s", first) != 1) {
+        return NULL;
+    }
+    Value *val = parseInteger(str);
+    if (val == NULL){
+        val = parseDouble(str);
+        if (val == NULL){
+            val = parseString(str);
+        }
+    }
+    return val;
+}
+
+/**
+Add the response to a sum command to an output buffer: the total as a double
+if any of the values were doubles, otherwise as an integer
+@param out buffer to add to
+@param sum totals of the values under the prefix
+*/
+void appendSum( Output *out, PrefixSum const *sum )
+{
+    char buffer[DOUBLE_LENGTH + 1];
+    if (sum->doubleCount > 0) {
+        formatDouble(sum->integers + ( sum->doubles + sum->doubleError ), buffer);
+    } else {
+        formatLong(sum->integers, buffer);
+    }
+    outputLine(out, buffer);
+}
+
+/** Names of the commands, indexed by CommandType. */
+static char const *const COMMAND_NAMES[ COMMAND_TYPES ] = {
+    "set", "get", "remove", "plus", "removeprefix", "count", "sum", "size", "save", "bgsave",
+    "optimize", "latency", "quit", "other"
+};
+
+/**
+Return the name of a command type, as typed by the user
+@param type the command type
+@return the command's name
+*/
+char const *commandName( CommandType type )
+{
+    return COMMAND_NAMES[type];
+}
+
+/**
+Break a command line into the command and its arguments, and parse the value
+for a set or plus command
+@param line the command line, without its newline
+@param cmd filled in with the parsed command
+*/
+void parseCommand( char const *line, ParsedCommand *cmd )
+{
+    cmd->line = line;
+    cmd->type = CMD_OTHER;
+    cmd->invalid = false;
+    cmd->argStart = -1;
+    cmd->argLen = 0;
+    cmd->val = NULL;
+
+    char command[strlen(line) + 1];
+    int n = 0;
+    if (sscanf(line, "%s%n", command, &n) != 1){
+        return;
+    }
+    for (int t = 0; t < CMD_OTHER; t++) {
+        if (strcmp(command, COMMAND_NAMES[t]) == 0) {
+            cmd->type = (CommandType) t;
+        }
+    }
+
+    // Most commands take a key, prefix or file name next.
+    char const *rest = line + n;
+    char arg[strlen(rest) + 1];
+    int end = 0;
+    if (sscanf(rest, " %n%s%n", &cmd->argStart, arg, &end) == 1) {
+        cmd->argStart += n;
+        cmd->argLen = strlen(arg);
+    } else {
+        cmd->argStart = -1;
+    }
+    bool hasArg = cmd->argStart >= 0;
+    switch (cmd->type) {
+    case CMD_SET:
+        if (hasArg) {
+            for (int i = 0; arg[i]; i ++) {
+                if (arg[i] > '~' || '!' > arg[i]) {
+                    hasArg = false;
+                }
+            }
+        }
+        if (hasArg) {
+            cmd->val = parseValue(rest + end);
+        }
+        cmd->invalid = cmd->val == NULL;
+        break;
+    case CMD_GET:
+        // A get takes just the key.
+        cmd->invalid = !hasArg || sscanf(rest + end, "%s", arg) == 1;
+        break;
+    case CMD_PLUS:
+        // Without a key, plus does nothing at all.
+        if (hasArg) {
+            cmd->val = parseValue(rest + end);
+            cmd->invalid = cmd->val == NULL;
+        }
+        break;
+    case CMD_REMOVE:
+    case CMD_REMOVE_PREFIX:
+    case CMD_SAVE:
+        cmd->invalid = !hasArg;
+        break;
+    case CMD_OTHER:
+        cmd->invalid = true;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+Run a parsed command against the given map, leaving its response in a result
+@param map map the command works on
+@param cmd the parsed command
+@param res filled in with the command's response
+*/
+void runCommand( Map *map, ParsedCommand *cmd, CommandResult *res )
+{
+    runCommandOnMaps(&map, 1, cmd, res);
+}
+
+/**
+Run a parsed command against keys split across several maps.  Commands on a
+single key use the first map; commands on a prefix or the whole map use all
+of them and add up their responses.
+@param maps the maps
+@param count number of maps
+@param cmd the parsed command
+@param res filled in with the command's response
+*/
+void runCommandOnMaps( Map *maps[], int count, ParsedCommand *cmd, CommandResult *res )
+{
+    Map *map = maps[0];
+    res->kind = cmd->invalid ? RESULT_INVALID : RESULT_NONE;
+    if (cmd->invalid) {
+        return;
+    }
+
+    // Without an argument, this is the empty string.
+    int from = 0, len = 0;
+    if (cmd->argStart >= 0) {
+        from = cmd->argStart;
+        len = cmd->argLen;
+    }
+    char arg[len + 1];
+    memcpy(arg, cmd->line + from, len);
+    arg[len] = '\0';
+
+    switch (cmd->type) {
+    case CMD_SET:
+        mapSet(map, arg, cmd->val);
+        break;
+    case CMD_GET: {
+        Value *val = mapGet(map, arg);
+        if (val == NULL) {
+            res->kind = RESULT_INVALID;
+        } else if (integerValue(val, &res->integer)) {
+            res->kind = RESULT_INTEGER;
+        } else if (doubleValue(val, &res->number)) {
+            res->kind = RESULT_DOUBLE;
+        } else {
+            res->kind = RESULT_TEXT;
+            res->text = val->toString(val);
+        }
+        break;
+    }
+    case CMD_REMOVE:
+        if (!mapRemove(map, arg)) {
+            res->kind = RESULT_INVALID;
+        }
+        break;
+    case CMD_PLUS:
+        if (cmd->val != NULL) {
+            if (!mapPlus(map, arg, cmd->val)) {
+                res->kind = RESULT_INVALID;
+            }
+            cmd->val->destroy(cmd->val);
+        }
+        break;
+    case CMD_REMOVE_PREFIX:
+        res->kind = RESULT_INTEGER;
+        res->integer = 0;
+        for (int i = 0; i < count; i++) {
+            res->integer += mapRemovePrefix(maps[i], arg);
+        }
+        break;
+    case CMD_COUNT:
+        res->kind = RESULT_INTEGER;
+        res->integer = 0;
+        for (int i = 0; i < count; i++) {
+            res->integer += mapPrefixCount(maps[i], arg);
+        }
+        break;
+    case CMD_SUM:
+        res->kind = RESULT_SUM;
+        res->sum.integers = res->sum.doubles = res->sum.doubleError = res->sum.doubleCount = 0;
+        for (int i = 0; i < count; i++) {
+            PrefixSum part;
+            mapPrefixSum(maps[i], arg, &part);
+            addPrefixSum(&res->sum, &part);
+        }
+        break;
+    case CMD_SIZE:
+        res->kind = RESULT_INTEGER;
+        res->integer = 0;
+        for (int i = 0; i < count; i++) {
+            res->integer += mapSize(maps[i]);
+        }
+        break;
+    case CMD_SAVE: {
+        long keys = dumpMaps(maps, count, arg);
+        res->kind = keys < 0 ? RESULT_INVALID : RESULT_INTEGER;
+        res->integer = keys;
+        break;
+    }
+    case CMD_OPTIMIZE:
+        for (int i = 0; i < count; i++) {
+            mapOptimizeLayout(maps[i]);
+        }
+        break;
+    default:
+        break;
+    }
+    cmd->val = NULL;
+}
+
+/**
+Add the response a command left in a result to an output buffer, and free
+anything the result holds
+@param out buffer to add to
+@param res the result
+*/
+void appendResult( Output *out, CommandResult *res )
+{
+    char buffer[DOUBLE_LENGTH + 1];
+    switch (res->kind) {
+    case RESULT_INVALID:
+        outputLine(out, "invalid");
+        break;
+    case RESULT_INTEGER:
+        formatInteger(res->integer, buffer);
+        outputLine(out, buffer);
+        break;
+    case RESULT_DOUBLE:
+        formatDouble(res->number, buffer);
+        outputLine(out, buffer);
+        break;
+    case RESULT_SUM:
+        appendSum(out, &res->sum);
+        break;
+    case RESULT_TEXT:
+        outputLine(out, res->text);
+        free(res->text);
+        break;
+    default:
+        break;
+    }
+    res->kind = RESULT_NONE;
+}
+
+/**
+Run one line of input as a command against the given map, adding the command's
+response (if any) to the output buffer.  The bgsave, latency and quit commands
+don't do anything here; it's up to the caller to act on them.
+@param map map the command works on
+@param line the command line, without its newline
+@param out buffer for the command's response
+@return the type of command that was run
+*/
+CommandType executeCommand( Map *map, char const *line, Output *out )
+{
+    ParsedCommand cmd;
+    CommandResult res;
+    parseCommand(line, &cmd);
+    runCommand(map, &cmd, &res);
+    appendResult(out, &res);
+    return cmd.type;
+}
@@ -0,0 +1,172 @@
+/**
+@file command
+@author Ethan Browne, efbrowne
+Parses and runs the driver's commands against a map, collecting their output
+in a buffer so the caller decides when and how it's written.
+*/
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "map.h"
+#include "value.h"
+#include <stdbool.h>
+
+/** Kinds of commands, as reported by executeCommand(). */
+typedef enum {
+  CMD_SET,
+  CMD_GET,
+  CMD_REMOVE,
+  CMD_PLUS,
+  CMD_REMOVE_PREFIX,
+  CMD_COUNT,
+  CMD_SUM,
+  CMD_SIZE,
+  CMD_SAVE,
+  CMD_BGSAVE,
+  CMD_OPTIMIZE,
+  CMD_LATENCY,
+  CMD_QUIT,
+  /** A blank line or a command that isn't recognized. */
+  CMD_OTHER
+} CommandType;
+
+/** Number of command types. */
+#define COMMAND_TYPES ( CMD_OTHER + 1 )
+
+/** Growable buffer of output text. */
+typedef struct {
+  /** The text, which isn't null terminated. */
+  char *text;
+
+  /** Number of characters in the buffer. */
+  int len;
+
+  /** Capacity of the text array. */
+  int cap;
+} Output;
+
+/** A command line broken into its parts by parseCommand(), ready to run. */
+typedef struct {
+  /** The command line, which has to outlive the parsed command. */
+  char const *line;
+
+  /** Kind of command. */
+  CommandType type;
+
+  /** True if the line is malformed, so running it just responds invalid. */
+  bool invalid;
+
+  /** Where the key, prefix or file name after the command starts in the
+      line, or -1 if there isn't one. */
+  int argStart;
+
+  /** Length of the key, prefix or file name. */
+  int argLen;
+
+  /** Value parsed for a set or plus command, or NULL.  It belongs to the
+      parsed command until the command runs. */
+  Value *val;
+} ParsedCommand;
+
+/** Kinds of responses a command can have. */
+typedef enum {
+  /** No response. */
+  RESULT_NONE,
+  RESULT_INVALID,
+  RESULT_INTEGER,
+  RESULT_DOUBLE,
+  /** The totals from a sum command. */
+  RESULT_SUM,
+  /** Text already converted, like a string value. */
+  RESULT_TEXT
+} ResultKind;
+
+/** The response to a command, as left by runCommand() for
+    appendResult() to turn into text.  Numbers are kept as numbers, so
+    they can be formatted on another thread. */
+typedef struct {
+  /** Kind of response. */
+  ResultKind kind;
+
+  /** The number, for RESULT_INTEGER. */
+  int integer;
+
+  /** The number, for RESULT_DOUBLE. */
+  double number;
+
+  /** The totals, for RESULT_SUM. */
+  PrefixSum sum;
+
+  /** Dynamically allocated text, for RESULT_TEXT. */
+  char *text;
+} CommandResult;
+
+/** Initialize an empty output buffer.
+    @param out buffer to initialize. */
+void initOutput( Output *out );
+
+/** Add characters to the end of an output buffer.
+    @param out buffer to add to.
+    @param str characters to add.
+    @param len number of characters to add. */
+void appendOutput( Output *out, char const *str, int len );
+
+/** Free the memory used by an output buffer.
+    @param out buffer to free. */
+void freeOutput( Output *out );
+
+/** Add the response to a sum command to an output buffer: the total as
+    a double if any of the values were doubles, otherwise as an integer.
+    @param out buffer to add to.
+    @param sum totals of the values under the prefix. */
+void appendSum( Output *out, PrefixSum const *sum );
+
+/** Add the response a command left in a result to an output buffer,
+    and free anything the result holds.
+    @param out buffer to add to.
+    @param res the result. */
+void appendResult( Output *out, CommandResult *res );
+
+/** Return the name of a command type, as typed by the user.
+    @param type the command type.
+    @return the command's name. */
+char const *commandName( CommandType type );
+
+/** Break a command line into the command and its arguments, and parse
+    the value for a set or plus command.  Doesn't touch any map, so a
+    line can be parsed on a different thread than the one that runs it.
+    @param line the command line, without its newline.
+    @param cmd filled in with the parsed command. */
+void parseCommand( char const *line, ParsedCommand *cmd );
+
+/** Run a parsed command against the given map, leaving its response in
+    a result.  The parsed command's value goes to the map or is freed.
+    The bgsave, latency and quit commands don't do anything here.
+    @param map map the command works on.
+    @param cmd the parsed command.
+    @param res filled in with the command's response. */
+void runCommand( Map *map, ParsedCommand *cmd, CommandResult *res );
+
+/** Run a parsed command against keys split across several maps, like
+    runCommand().  Commands on a single key run against the first map,
+    which has to be the one that holds the key.  Commands on a prefix or
+    the whole map run against every map, with their counts and sums
+    added up, and save writes all the maps to one file.
+    @param maps the maps.
+    @param count number of maps.
+    @param cmd the parsed command.
+    @param res filled in with the command's response. */
+void runCommandOnMaps( Map *maps[], int count, ParsedCommand *cmd, CommandResult *res );
+
+/** Run one line of input as a command against the given map, adding the
+    command's response (if any) to the output buffer.  The bgsave,
+    latency and quit commands don't do anything here; it's up to the
+    caller to act on them.
+    @param map map the command works on.
+    @param line the command line, without its newline.
+    @param out buffer for the command's response.
+    @return the type of command that was run. */
+CommandType executeCommand( Map *map, char const *line, Output *out );
+
+#endif
@@ -0,0 +1,195 @@
+/**
+@file counters
+@author Ethan Browne, efbrowne
+Hardware performance counters for regions of code.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include "counters.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/** Type and config for each event, indexed by CounterEvent. */
+static struct {
+  unsigned type;
+  unsigned long long config;
+} const EVENTS[ COUNTER_EVENTS ] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) |
+                        ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK }
+};
+
+/** Column headings for the events. */
+static char const *const EVENT_NAMES[ COUNTER_EVENTS ] = {
+  "cycles", "instrs", "cache-miss", "branch-miss", "dtlb-miss", "cpu-ns"
+};
+
+/**
+Open the counters for the calling thread.  Each event that can be opened
+joins the group led by the first one.
+@param c the counters to open
+@return true if at least one event is being counted
+*/
+bool openCounters( Counters *c )
+{
+  c->events = 0;
+  c->available = 0;
+  c->error = 0;
+  int leader = -1;
+  for ( int e = 0; e < COUNTER_EVENTS; e++ ) {
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.size = sizeof( attr );
+    attr.type = EVENTS[ e ].type;
+    attr.config = EVENTS[ e ].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    c->fd[ e ] = syscall( SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC );
+    if ( c->fd[ e ] < 0 ) {
+      if ( c->error == 0 )
+        c->error = errno;
+      c->fd[ e ] = -1;
+      continue;
+    }
+    if ( leader < 0 )
+      leader = c->fd[ e ];
+    c->slot[ e ] = c->events++;
+    c->available |= 1 << e;
+  }
+  return c->events > 0;
+}
+
+/**
+Close a thread's counters
+@param c the counters
+*/
+void closeCounters( Counters *c )
+{
+  for ( int e = COUNTER_EVENTS - 1; e >= 0; e-- )
+    if ( c->fd[ e ] >= 0 )
+      close( c->fd[ e ] );
+  c->events = 0;
+  c->available = 0;
+}
+
+/**
+Read the current count of every event.  If the kernel had to share the
+hardware counters with other groups, the counts are scaled up by how much of
+the time this group was actually counting.
+@param c the counters
+@param s filled in with the counts
+*/
+void readCounters( Counters const *c, CounterSample *s )
+{
+  memset( s, 0, sizeof( CounterSample ) );
+  if ( c->events == 0 )
+    return;
+
+  // The number of events, the time enabled and running, then the counts.
+  unsigned long long buffer[ 3 + COUNTER_EVENTS ];
+  int leader = -1;
+  for ( int e = 0; leader < 0; e++ )
+    leader = c->fd[ e ];
+  if ( read( leader, buffer, sizeof( buffer ) ) < (ssize_t) ( ( 3 + c->events ) * sizeof( buffer[ 0 ] ) ) )
+    return;
+  double scale = 1;
+  if ( buffer[ 2 ] > 0 && buffer[ 2 ] < buffer[ 1 ] )
+    scale = (double) buffer[ 1 ] / buffer[ 2 ];
+  for ( int e = 0; e < COUNTER_EVENTS; e++ )
+    if ( c->fd[ e ] >= 0 )
+      s->count[ e ] = scale == 1 ? buffer[ 3 + c->slot[ e ] ] : buffer[ 3 + c->slot[ e ] ] * scale;
+}
+
+/**
+Initialize totals with nothing counted
+@param t the totals
+*/
+void initTotals( CounterTotals *t )
+{
+  memset( t, 0, sizeof( CounterTotals ) );
+}
+
+/**
+Read the counters at the end of a region, and add what happened since the
+start of it to a set of totals
+@param c the counters
+@param start counts read at the start of the region
+@param t totals to add to
+@param ops number of operations done in the region
+*/
+void endRegion( Counters const *c, CounterSample const *start, CounterTotals *t, long ops )
+{
+  CounterSample end;
+  readCounters( c, &end );
+  for ( int e = 0; e < COUNTER_EVENTS; e++ )
+    t->count[ e ] += end.count[ e ] - start->count[ e ];
+  t->ops += ops;
+  t->available |= c->available;
+}
+
+/**
+Add one set of totals into another
+@param t totals to add to
+@param other totals to add from
+*/
+void mergeTotals( CounterTotals *t, CounterTotals const *other )
+{
+  for ( int e = 0; e < COUNTER_EVENTS; e++ )
+    t->count[ e ] += other->count[ e ];
+  t->ops += other->ops;
+  t->available |= other->available;
+}
+
+/**
+Write a line naming the columns that reportCounters() writes
+@param fp stream to write to
+*/
+void counterHeader( FILE *fp )
+{
+  fprintf( fp, "%-8s %10s", "region", "ops" );
+  for ( int e = 0; e < COUNTER_EVENTS; e++ ) {
+    fprintf( fp, " %11s", EVENT_NAMES[ e ] );
+    if ( e == EVENT_INSTRUCTIONS )
+      fprintf( fp, " %5s", "ipc" );
+  }
+  fprintf( fp, " (per op)\n" );
+}
+
+/**
+Write a line of per-operation figures for a set of totals, with a dash for
+each event that wasn't counted
+@param fp stream to write to
+@param name name of the region
+@param t the totals
+*/
+void reportCounters( FILE *fp, char const *name, CounterTotals const *t )
+{
+  fprintf( fp, "%-8s %10ld", name, t->ops );
+  long ops = t->ops > 0 ? t->ops : 1;
+  for ( int e = 0; e < COUNTER_EVENTS; e++ ) {
+    if ( t->available & ( 1 << e ) )
+      fprintf( fp, " %11.1f", (double) t->count[ e ] / ops );
+    else
+      fprintf( fp, " %11s", "-" );
+
+    // Instructions per cycle, when both were counted.
+    if ( e == EVENT_INSTRUCTIONS ) {
+      int both = ( 1 << EVENT_CYCLES ) | ( 1 << EVENT_INSTRUCTIONS );
+      if ( ( t->available & both ) == both && t->count[ EVENT_CYCLES ] > 0 )
+        fprintf( fp, " %5.2f", (double) t->count[ EVENT_INSTRUCTIONS ] / t->count[ EVENT_CYCLES ] );
+      else
+        fprintf( fp, " %5s", "-" );
+    }
+  }
+  fprintf( fp, "\n" );
+}
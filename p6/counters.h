@@ -0,0 +1,110 @@
+/**
+@file counters
+@author Ethan Browne, efbrowne
+Hardware performance counters, read with perf_event_open(), for finding out
+why a region of code got faster or slower: the cycles, instructions, cache
+misses, branch misses and dTLB misses it took, along with the CPU time it
+used.  All the events are opened as one group on the calling thread and
+counted in user space only, so starting or ending a region is a single read().
+Events the system can't count (in most containers and VMs, all of the
+hardware ones) are left out of the group and reported as unavailable.
+*/
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/** The events counted. */
+typedef enum {
+  EVENT_CYCLES,
+  EVENT_INSTRUCTIONS,
+  EVENT_CACHE_MISSES,
+  EVENT_BRANCH_MISSES,
+  EVENT_DTLB_MISSES,
+  EVENT_TASK_CLOCK,
+  COUNTER_EVENTS
+} CounterEvent;
+
+/** Counters open on one thread. */
+typedef struct {
+  /** Descriptor for each event, or -1 if it couldn't be opened.  The first
+      one opened leads the group. */
+  int fd[ COUNTER_EVENTS ];
+
+  /** Position of each event in a read of the group. */
+  int slot[ COUNTER_EVENTS ];
+
+  /** Number of events in the group. */
+  int events;
+
+  /** Bit 1 << e is set if event e is being counted. */
+  int available;
+
+  /** errno from the first event that couldn't be opened, or 0. */
+  int error;
+} Counters;
+
+/** Counts of every event at one moment. */
+typedef struct {
+  long long count[ COUNTER_EVENTS ];
+} CounterSample;
+
+/** Counts of every event, added up over any number of regions. */
+typedef struct {
+  /** Total count of each event. */
+  long long count[ COUNTER_EVENTS ];
+
+  /** Number of operations the regions did, for per-operation figures. */
+  long ops;
+
+  /** Bit 1 << e is set if event e was counted in any of the regions. */
+  int available;
+} CounterTotals;
+
+/** Open the counters for the calling thread.  They only count what that
+    thread does, from now on.
+    @param c the counters to open.
+    @return true if at least one event is being counted. */
+bool openCounters( Counters *c );
+
+/** Close a thread's counters.
+    @param c the counters. */
+void closeCounters( Counters *c );
+
+/** Read the current count of every event.  Events that aren't being counted
+    read as zero.  Must be called by the thread that opened the counters.
+    @param c the counters.
+    @param s filled in with the counts. */
+void readCounters( Counters const *c, CounterSample *s );
+
+/** Initialize totals with nothing counted.
+    @param t the totals. */
+void initTotals( CounterTotals *t );
+
+/** Read the counters at the end of a region, and add what happened since
+    the start of it to a set of totals.
+    @param c the counters.
+    @param start counts read at the start of the region.
+    @param t totals to add to.
+    @param ops number of operations done in the region. */
+void endRegion( Counters const *c, CounterSample const *start, CounterTotals *t, long ops );
+
+/** Add one set of totals into another.
+    @param t totals to add to.
+    @param other totals to add from. */
+void mergeTotals( CounterTotals *t, CounterTotals const *other );
+
+/** Write a line naming the columns that reportCounters() writes.
+    @param fp stream to write to. */
+void counterHeader( FILE *fp );
+
+/** Write a line of per-operation figures for a set of totals, with a dash
+    for each event that wasn't counted.
+    @param fp stream to write to.
+    @param name name of the region, at most 8 characters.
+    @param t the totals. */
+void reportCounters( FILE *fp, char const *name, CounterTotals const *t );
+
+#endif
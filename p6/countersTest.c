@@ -0,0 +1,84 @@
+// Simple test program for the performance counters.  Most systems this runs
+// on can't count the hardware events, so it checks whatever is available.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "counters.h"
+
+// Iterations of the loop that's counted.
+#define LOOP 10000000
+
+int main()
+{
+  Counters c;
+  bool opened = openCounters( &c );
+  printf( "events counted:" );
+  for ( int e = 0; e < COUNTER_EVENTS; e++ )
+    if ( c.available & ( 1 << e ) )
+      printf( " %d", e );
+  printf( opened ? "\n" : " none (%s)\n", strerror( c.error ) );
+  assert( opened == ( c.available != 0 ) );
+  assert( opened || c.error != 0 );
+
+  // Count a loop that can't be optimized away.
+  CounterSample start;
+  readCounters( &c, &start );
+  volatile long sum = 0;
+  for ( long i = 0; i < LOOP; i++ )
+    sum += i;
+  CounterTotals t;
+  initTotals( &t );
+  endRegion( &c, &start, &t, LOOP );
+  assert( t.ops == LOOP );
+  assert( t.available == c.available );
+  for ( int e = 0; e < COUNTER_EVENTS; e++ )
+    assert( ( c.available & ( 1 << e ) ) || t.count[ e ] == 0 );
+  if ( c.available & ( 1 << EVENT_INSTRUCTIONS ) )
+    assert( t.count[ EVENT_INSTRUCTIONS ] >= LOOP );
+  if ( c.available & ( 1 << EVENT_CYCLES ) )
+    assert( t.count[ EVENT_CYCLES ] > 0 );
+  if ( c.available & ( 1 << EVENT_TASK_CLOCK ) )
+    assert( t.count[ EVENT_TASK_CLOCK ] > 0 );
+
+  // Totals add up.
+  CounterTotals all;
+  initTotals( &all );
+  mergeTotals( &all, &t );
+  mergeTotals( &all, &t );
+  assert( all.ops == 2 * LOOP );
+  assert( all.available == t.available );
+  for ( int e = 0; e < COUNTER_EVENTS; e++ )
+    assert( all.count[ e ] == 2 * t.count[ e ] );
+
+  // Events that weren't counted show up as dashes.
+  CounterTotals none;
+  initTotals( &none );
+  none.ops = 5;
+  char *text;
+  size_t len;
+  FILE *fp = open_memstream( &text, &len );
+  reportCounters( fp, "none", &none );
+  fclose( fp );
+  assert( strcmp( text, "none              5           -           -     -"
+                  "           -           -           -           -\n" ) == 0 );
+  free( text );
+
+  // Per-operation figures, with instructions per cycle.
+  none.available = ( 1 << EVENT_CYCLES ) | ( 1 << EVENT_INSTRUCTIONS );
+  none.count[ EVENT_CYCLES ] = 10;
+  none.count[ EVENT_INSTRUCTIONS ] = 25;
+  fp = open_memstream( &text, &len );
+  reportCounters( fp, "some", &none );
+  fclose( fp );
+  assert( strcmp( text, "some              5         2.0         5.0  2.50"
+                  "           -           -           -           -\n" ) == 0 );
+  free( text );
+
+  closeCounters( &c );
+  return EXIT_SUCCESS;
+}
@@ -12,11 +12,12 @@ make
 rm -f *.gcda
 
 echo "Running test inputs given with the starter"
-for i in 01 02 03 04 05 06 07 08 09 10 11
+for i in 01 02 03 04 05 06 07 08 09 10 11 12 13 14 15
 do
     echo "./driver < input-$i.txtt"
     ./driver < input-$i.txt > output.txt
 done
+rm -f dump-13.txt
 
 # Run the student-generated test cases.
 list=$(echo my-input-*.txt)
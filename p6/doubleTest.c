@@ -55,6 +55,26 @@ int main()
   v4 = parseInteger( "5" );
   assert( v3->plus( v3, v4 ) == false );
   
+  // Try the shortest round-trip format.
+  setDoubleFormat( DOUBLE_SHORTEST );
+  s1 = v3->toString( v3 );
+  assert( strcmp( s1, "1003.5001" ) == 0 );
+  free( s1 );
+
+  s1 = v1->toString( v1 );
+  assert( strcmp( s1, "1.0" ) == 0 );
+  free( s1 );
+
+  Value *v5 = parseDouble( "0.1" );
+  Value *v6 = parseDouble( "0.2" );
+  assert( v5->plus( v5, v6 ) );
+  s1 = v5->toString( v5 );
+  assert( strcmp( s1, "0.30000000000000004" ) == 0 );
+  free( s1 );
+  v5->destroy( v5 );
+  v6->destroy( v6 );
+  setDoubleFormat( DOUBLE_FIXED );
+
   // Free the double objects.
   v1->destroy( v1 );
   v2->destroy( v2 );
@@ -1,132 +1,1100 @@
-/**
-@file driver
-@author Ethan Browne
-Top level of program. Contains main method
-*/
-#include "input.h"
-#include "value.h"
-#include "map.h"
-
-
-/**
-The main method
-@return whether the program was run successfully
-*/
-int main()
-{
-    Map* map = makeMap();
-    char *line = readLine(NULL);
-    printf("cmd> ");
-
-    while (line != NULL){
-        char command[strlen(line) + 1];
-        memset( command, '\0', strlen(line) + 1);
-
-        int offset = 0;
-        int n = 0;
-        printf("%s\n", line);
-        if (sscanf(line, "%s%n", command, &n) == 1){
-            offset += n;
-            if (strcmp(command, "set") == 0) {
-                char key[strlen(line + offset) + 1];
-                memset( key, '\0', strlen(line + offset) + 1);
-                if (sscanf(line + offset, "%s%n", key, &n) == 1) { // Get the Key
-                    bool validKey = true;
-                    for (int i = 0; key[i]; i ++) {
-                        if (key[i] > '~' || '!' > key[i]) {
-                            validKey = false;
-                        }
-                    }
-                    if (validKey) {
-                        offset += n;
-                        Value *val = parseInteger(line + offset);
-                        if (val == NULL){
-                            val = parseDouble(line + offset);
-                            if (val == NULL){
-                                val = parseString(line + offset);
-                            }
-                        }
-                        mapSet(map, key, val);
-                    } else {
-                        printf("invalid\n");
-                    }
-                } else {
-                    printf("invalid\n");
-                }
-            } else if (strcmp(command, "get") == 0) {
-                char key[strlen(line + offset) + 1];
-                memset( key, '\0', strlen(line + offset) + 1);
-                if (sscanf(line + offset, "%s%n", key, &n) == 1) { // Get the Key
-                    offset += n;
-                    if (sscanf(line + offset, "%s%n", key, &n) != 1){
-                        Value *val = mapGet(map, key);
-                        if (val == NULL) {
-                            printf("invalid\n");
-                        } else {
-                            char *s = val->toString(val);
-                            printf("%s\n", s);
-                            free(s);
-                        }
-                    } else {
-                        printf("invalid\n");
-                    }
-                } else {
-                    printf("invalid\n");
-                }
-            } else if (strcmp(command, "remove") == 0) {
-                char key[strlen(line + offset) + 1];
-                memset( key, '\0', strlen(line + offset) + 1);
-                if (sscanf(line + offset, "%s%n", key, &n) == 1) { // Get the Key
-                    if (!mapRemove(map, key)) {
-                        printf("invalid\n");
-                    }
-                } else {
-                    printf("invalid\n");
-                }
-            } else if (strcmp(command, "plus") == 0) {
-                char key[strlen(line + offset) + 1];
-                memset( key, '\0', strlen(line + offset) + 1);
-                if (sscanf(line + offset, "%s%n", key, &n) == 1) { // Get the Key
-                    Value *val = mapGet(map, key);
-                    if (val == NULL) {
-                        printf("invalid\n");
-                    } else {
-                        offset += n;
-                        Value *newVal = parseInteger(line + offset);
-                        bool goodVal = true;
-                        if (newVal == NULL){
-                            newVal = parseDouble(line + offset);
-                            if (newVal == NULL){
-                                newVal = parseString(line + offset);
-                                 if (newVal == NULL){
-                                    printf("invalid\n");
-                                    goodVal = false;
-                                }
-                            }
-                        }
-                        if (goodVal) {
-                            if (!val->plus(val, newVal)){
-                                printf("invalid\n");
-                            }
-                            newVal->destroy(newVal);
-                        }
-                    }
-                }
-            } else if (strcmp(command, "size") == 0) {
-                printf("%d\n", mapSize(map));
-            } else if (strcmp(command, "quit") == 0) {
-                free(line);
-                freeMap(map);
-                return EXIT_SUCCESS;
-            } else {
-                printf("invalid\n");
-            }
-        }
-        free(line);
-        line = readLine(NULL);
-        printf("\ncmd> ");
-    }
-    free(line);
-    freeMap(map);
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+/**
+@file driver
+@author Ethan Browne
+Top level of program. Contains main method
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "input.h"
+#include "value.h"
+#include "map.h"
+#include "command.h"
+#include "profile.h"
+#include "counters.h"
+#include "dump.h"
+#include "ring.h"
+#include "pool.h"
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+/** Most worker threads allowed in parallel mode. */
+#define MAX_THREADS 64
+
+/** Batch mode collects output until it has this many bytes, then writes it. */
+#define BATCH_CHUNK ( 1 << 16 )
+
+/** Number of commands each stage of pipelined mode can get ahead of the
+    next one. */
+#define PIPELINE_DEPTH 1024
+
+/** Settings from the command line, used for every map the driver makes. */
+typedef struct {
+    /** Memory limit for each map, or 0 for no limit. */
+    long limit;
+
+    /** Number of front cache entries for each map, or 0 for none. */
+    int frontEntries;
+
+    /** Bits per key for each map's Bloom filter, or 0 for none. */
+    int bloomBits;
+
+    /** Number of worker threads for parallel replay, or 0 to run commands
+        one at a time as they're read. */
+    int threads;
+
+    /** True if command latencies should be recorded. */
+    bool profile;
+
+    /** True to print just the responses, without prompts or echoed commands,
+        writing them to standard output in large chunks. */
+    bool batch;
+
+    /** True if string values are interned. */
+    bool intern;
+
+    /** True if keys removed by prefix are freed on a background thread. */
+    bool backgroundFree;
+
+    /** True to read and parse commands, run them, and write the responses
+        on three separate threads. */
+    bool pipeline;
+
+    /** True to count cycles, cache misses and so on for each type of
+        command and for the whole run. */
+    bool perfCounters;
+} Options;
+
+/** Performance counters for one thread, with totals for each type of command
+    it runs and for everything it does. */
+typedef struct {
+    /** The thread's counters. */
+    Counters counters;
+
+    /** Totals for the commands of each type. */
+    CounterTotals type[COMMAND_TYPES];
+
+    /** Totals for the thread from when the counters were opened until they
+        were closed. */
+    CounterTotals thread;
+
+    /** Counts when the counters were opened. */
+    CounterSample opened;
+} CommandCounters;
+
+/** A command line read in parallel mode, with the results of running it. */
+typedef struct {
+    /** The command line. */
+    char *line;
+
+    /** The command, parsed as it was read. */
+    ParsedCommand cmd;
+
+    /** Partition (and worker thread) the command belongs to, or -1 for a
+        command that has to wait for all the commands before it. */
+    int part;
+
+    /** Where the command's response starts in its worker's output buffer. */
+    int outStart;
+
+    /** Length of the command's response. */
+    int outLen;
+} Command;
+
+/** State shared by the main thread and the workers in parallel mode. */
+typedef struct {
+    /** All the commands. */
+    Command *cmds;
+
+    /** Index of the barrier command ending the current segment. */
+    int end;
+
+    /** Set when the workers should exit. */
+    bool stop;
+
+    /** Workers wait here for a segment to start. */
+    pthread_barrier_t start;
+
+    /** Workers wait here when they finish a segment. */
+    pthread_barrier_t done;
+} Replay;
+
+/** Everything one worker thread needs to replay its partition. */
+typedef struct {
+    /** The shared replay state. */
+    Replay *replay;
+
+    /** The map for this partition. */
+    Map *map;
+
+    /** Indices of this partition's commands, in order. */
+    int *mine;
+
+    /** Number of commands in the partition, and capacity of mine. */
+    int count, cap;
+
+    /** Position in mine of the next command to run. */
+    int next;
+
+    /** Responses from this worker's commands in the current segment. */
+    Output out;
+
+    /** Latencies of this worker's commands, or NULL if not profiling. */
+    Profile *profile;
+
+    /** Counters for this worker's commands, or NULL if not counting. */
+    CommandCounters *counters;
+} Worker;
+
+/** A command on its way through the threads in pipelined mode. */
+typedef struct {
+    /** The command line. */
+    char *line;
+
+    /** The command, parsed by the reader. */
+    ParsedCommand cmd;
+
+    /** The response, left by the executor for the writer to format. */
+    CommandResult result;
+
+    /** Response made by the executor itself, for the commands the driver
+        handles, or one with no text if there isn't one. */
+    Output report;
+} Job;
+
+/** The rings connecting the threads in pipelined mode. */
+typedef struct {
+    /** Parsed commands, from the reader to the executor. */
+    Ring parsed;
+
+    /** Commands that have run, from the executor to the writer. */
+    Ring done;
+
+    /** The settings from the command line. */
+    Options const *opts;
+
+    /** Counters for the reader and writer threads, or NULL if not
+        counting. */
+    CommandCounters *readerCounters, *writerCounters;
+} Pipeline;
+
+/** A dump started by bgsave, with the latencies of the commands run while
+    the child process was writing it. */
+typedef struct {
+    /** Process id of the child writing the dump, or 0 if none is running. */
+    pid_t pid;
+
+    /** Name of the dump file. */
+    char *file;
+
+    /** Number of keys in the maps when the child was forked. */
+    long keys;
+
+    /** Time the dump started, from profileClock(). */
+    long start;
+
+    /** Nanoseconds the fork itself took. */
+    long forkTime;
+
+    /** Number of commands run while the dump was going, their total
+        latency and the longest one. */
+    long during, duringTotal, duringMax;
+
+    /** Number of commands run while no dump was going, since the first
+        bgsave, and their total latency. */
+    long outside, outsideTotal;
+} DumpJob;
+
+/** Output waiting to be written in batch mode. */
+static Output pending;
+
+/** The latest background dump.  Once there's been one, commands are timed
+    so the report can show how much the dump slowed them down. */
+static DumpJob dump;
+
+/** True once a bgsave has been started. */
+static bool dumped;
+
+/** Jobs for pipelined mode, made by the reader and freed by the writer. */
+static Pool jobPool = POOL_INITIALIZER( "job", Job );
+
+/**
+Prints a usage message and exits unsuccessfully
+*/
+static void usage()
+{
+    fprintf(stderr, "usage: driver [--limit bytes] [--front-cache entries] [--bloom bits] [--shortest] [--parallel threads] [--profile] [--batch] [--intern] [--background-free] [--pipeline] [--perf-counters]\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+Makes a map with the settings from the command line
+@param opts the settings
+@param parts number of maps the data is split across
+@return the new map
+*/
+static Map *makeDriverMap( Options const *opts, int parts )
+{
+    Map *map = opts->limit > 0 ? makeMapWithLimit(opts->limit / parts) : makeMap();
+    if (opts->frontEntries > 0) {
+        mapEnableFrontCache(map, opts->frontEntries);
+    }
+    if (opts->bloomBits > 0) {
+        mapEnableBloomFilter(map, opts->bloomBits);
+    }
+    mapFreeInBackground(map, opts->backgroundFree);
+    return map;
+}
+
+/**
+Makes a set of counters if the driver is counting.  They still have to be
+opened by the thread they're for.
+@param opts the settings from the command line
+@return the counters, or NULL
+*/
+static CommandCounters *makeCommandCounters( Options const *opts )
+{
+    return opts->perfCounters ? (CommandCounters *) malloc(sizeof(CommandCounters)) : NULL;
+}
+
+/**
+Opens the counters for the calling thread, with no commands counted yet
+@param cc the counters, or NULL if the driver isn't counting
+*/
+static void openCommandCounters( CommandCounters *cc )
+{
+    if (cc == NULL) {
+        return;
+    }
+    for (int t = 0; t < COMMAND_TYPES; t++) {
+        initTotals(&cc->type[t]);
+    }
+    initTotals(&cc->thread);
+    openCounters(&cc->counters);
+    readCounters(&cc->counters, &cc->opened);
+}
+
+/**
+Adds up everything the calling thread did since it opened its counters, then
+closes them
+@param cc the counters, or NULL if the driver isn't counting
+*/
+static void closeCommandCounters( CommandCounters *cc )
+{
+    if (cc != NULL) {
+        endRegion(&cc->counters, &cc->opened, &cc->thread, 0);
+        closeCounters(&cc->counters);
+    }
+}
+
+/**
+Adds the totals from another thread's closed counters into a set of counters
+@param cc counters to add to
+@param other counters to add from
+*/
+static void mergeCommandCounters( CommandCounters *cc, CommandCounters const *other )
+{
+    for (int t = 0; t < COMMAND_TYPES; t++) {
+        mergeTotals(&cc->type[t], &other->type[t]);
+    }
+    mergeTotals(&cc->thread, &other->thread);
+}
+
+/**
+Starts timing a command, and counting its events if there are counters
+@param cc counters for the thread, or NULL
+@param start filled in with the counts at the start
+@return the time from profileClock()
+*/
+static long startCommand( CommandCounters *cc, CounterSample *start )
+{
+    if (cc != NULL) {
+        readCounters(&cc->counters, start);
+    }
+    return profileClock();
+}
+
+/**
+Records a command's latency if there's a profile, and its events if there are
+counters
+@param profile profile to record the latency in, or NULL
+@param cc counters for the thread, or NULL
+@param type the type of command
+@param start time the command started
+@param counts counts when the command started
+*/
+static void finishCommand( Profile *profile, CommandCounters *cc, CommandType type, long start,
+                           CounterSample const *counts )
+{
+    long ns = profileClock() - start;
+    if (cc != NULL) {
+        endRegion(&cc->counters, counts, &cc->type[type], 1);
+    }
+    if (profile != NULL) {
+        recordLatency(profile, type, ns);
+    }
+}
+
+/**
+Runs one command, recording its latency if there's a profile and its events
+if there are counters
+@param map map the command works on
+@param line the command line
+@param out buffer for the command's response
+@param profile profile to record the latency in, or NULL
+@param cc counters for the thread, or NULL
+@return the type of command that was run
+*/
+static CommandType timedCommand( Map *map, char const *line, Output *out, Profile *profile,
+                                 CommandCounters *cc )
+{
+    if (profile == NULL && cc == NULL) {
+        return executeCommand(map, line, out);
+    }
+    CounterSample counts;
+    long start = startCommand(cc, &counts);
+    CommandType type = executeCommand(map, line, out);
+    finishCommand(profile, cc, type, start, &counts);
+    return type;
+}
+
+/**
+Responds to the latency command, with a report from the given profile
+@param profile the profile, or NULL if the driver isn't profiling
+@param out buffer for the response
+*/
+static void latencyCommand( Profile const *profile, Output *out )
+{
+    if (profile == NULL) {
+        appendOutput(out, "invalid\n", 8);
+    } else {
+        reportProfile(profile, out);
+    }
+}
+
+/**
+Prints the latency report to standard error as the driver exits
+@param profile the profile, or NULL if the driver isn't profiling
+*/
+static void exitReport( Profile const *profile )
+{
+    if (profile != NULL) {
+        Output report;
+        initOutput(&report);
+        reportProfile(profile, &report);
+        fwrite(report.text, 1, report.len, stderr);
+        freeOutput(&report);
+    }
+}
+
+/**
+Prints what the counters counted to standard error as the driver exits: the
+figures per command for each type of command, then for the whole run, which
+covers reading and printing the commands too
+@param cc counters with the totals for every thread, or NULL if the driver
+isn't counting
+*/
+static void countersReport( CommandCounters *cc )
+{
+    if (cc == NULL) {
+        return;
+    }
+    if (cc->thread.available == 0) {
+        fprintf(stderr, "perf counters unavailable: %s\n", strerror(cc->counters.error));
+        return;
+    }
+    counterHeader(stderr);
+    cc->thread.ops = 0;
+    for (int t = 0; t < COMMAND_TYPES; t++) {
+        if (cc->type[t].ops > 0) {
+            reportCounters(stderr, commandName(t), &cc->type[t]);
+            cc->thread.ops += cc->type[t].ops;
+        }
+    }
+    reportCounters(stderr, "run", &cc->thread);
+}
+
+/**
+Responds to the bgsave command by forking a child process that dumps the
+maps, unless a dump is already running.  Nothing is printed if the dump
+starts; the report comes on standard error when it's finished.
+@param maps the maps to dump
+@param count number of maps
+@param line the command line, with the dump file after the command
+@param out buffer for the response
+*/
+static void bgsaveCommand( Map *maps[], int count, char const *line, Output *out )
+{
+    char command[strlen(line) + 1];
+    char file[strlen(line) + 1];
+    if (dump.pid > 0 || sscanf(line, "%s%s", command, file) != 2) {
+        appendOutput(out, "invalid\n", 8);
+        return;
+    }
+    long keys = 0;
+    for (int i = 0; i < count; i++) {
+        keys += mapSize(maps[i]);
+    }
+    long start = profileClock();
+    pid_t pid = forkDump(maps, count, file);
+    if (pid < 0) {
+        appendOutput(out, "invalid\n", 8);
+        return;
+    }
+    free(dump.file);
+    dump.pid = pid;
+    dump.file = strdup(file);
+    dump.keys = keys;
+    dump.start = start;
+    dump.forkTime = profileClock() - start;
+    dump.during = dump.duringTotal = dump.duringMax = 0;
+    dumped = true;
+}
+
+/**
+Adds a command's latency to the totals for the current dump, or for commands
+run between dumps
+@param ns how long the command took
+@param during true if a dump was running when the command started
+*/
+static void dumpLatency( long ns, bool during )
+{
+    if (during) {
+        dump.during++;
+        dump.duringTotal += ns;
+        if (ns > dump.duringMax) {
+            dump.duringMax = ns;
+        }
+    } else {
+        dump.outside++;
+        dump.outsideTotal += ns;
+    }
+}
+
+/**
+Checks whether the background dump has finished and, if it has, prints how
+long it took and how the commands run meanwhile did to standard error
+@param wait true to wait for the dump to finish
+*/
+static void finishDump( bool wait )
+{
+    int status;
+    if (dump.pid <= 0 || waitpid(dump.pid, &status, wait ? 0 : WNOHANG) <= 0) {
+        return;
+    }
+    dump.pid = 0;
+    double ms = (profileClock() - dump.start) / 1e6;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "bgsave %s: failed after %.1f ms\n", dump.file, ms);
+        return;
+    }
+    fprintf(stderr, "bgsave %s: %ld keys in %.1f ms, fork %.2f ms", dump.file, dump.keys,
+            ms, dump.forkTime / 1e6);
+    if (dump.during > 0) {
+        fprintf(stderr, "; %ld commands during dump, mean %.2f us, max %.2f us",
+                dump.during, dump.duringTotal / 1e3 / dump.during, dump.duringMax / 1e3);
+        if (dump.outside > 0) {
+            fprintf(stderr, " (mean %.2f us otherwise)", dump.outsideTotal / 1e3 / dump.outside);
+        }
+    }
+    fprintf(stderr, "\n");
+}
+
+/**
+Prints how much interning deduplicated string values to standard error, if
+the driver is interning them.  Called before the maps are freed.
+@param opts the settings from the command line
+*/
+static void internReport( Options const *opts )
+{
+    if (opts->intern) {
+        InternStats stats;
+        internStats(&stats);
+        fprintf(stderr, "interned strings: %ld distinct, %ld values, dedup ratio %.1f, %ld bytes saved\n",
+                stats.strings, stats.values,
+                stats.strings > 0 ? (double) stats.values / stats.strings : 0.0, stats.savedBytes);
+    }
+}
+
+/**
+Writes all of the given blocks of text to standard output, picking up where
+writev() left off if it only writes part of them
+@param iov the blocks, which may be modified
+@param count number of blocks
+*/
+static void writeBlocks( struct iovec *iov, int count )
+{
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        while (count > 0 && n >= (ssize_t) iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/**
+Adds text to the batch mode output, writing out the buffer when it fills up.
+Text that's at least a chunk long is written along with the buffer in one
+writev(), without being copied.
+@param str the text
+@param len number of characters in the text
+*/
+static void batchOutput( char const *str, int len )
+{
+    if (pending.len + len <= BATCH_CHUNK) {
+        appendOutput(&pending, str, len);
+        return;
+    }
+    struct iovec iov[] = { { pending.text, pending.len }, { (char *) str, len } };
+    if (len >= BATCH_CHUNK) {
+        writeBlocks(iov, 2);
+        pending.len = 0;
+    } else {
+        writeBlocks(iov, 1);
+        pending.len = 0;
+        appendOutput(&pending, str, len);
+    }
+}
+
+/**
+Writes whatever batch mode output is still in the buffer
+*/
+static void flushBatch()
+{
+    struct iovec iov = { pending.text, pending.len };
+    writeBlocks(&iov, 1);
+    pending.len = 0;
+}
+
+/**
+Prints a command's response.  Interactively, the command is echoed first, and
+a prompt for the next one follows the response unless this was the last
+command.  In batch mode, only the response is printed.
+@param opts the settings from the command line
+@param line the command line
+@param text the response
+@param len number of characters in the response
+@param more true if there may be more commands after this one
+*/
+static void respond( Options const *opts, char const *line, char const *text, int len, bool more )
+{
+    if (opts->batch) {
+        batchOutput(text, len);
+    } else {
+        printf("%s\n", line);
+        fwrite(text, 1, len, stdout);
+        if (more) {
+            printf("\ncmd> ");
+        }
+    }
+}
+
+/**
+Reads and runs commands one at a time, echoing each one after a prompt unless
+the driver is in batch mode
+@param opts the settings from the command line
+@param cc counters for this thread, or NULL
+*/
+static void runSequential( Options const *opts, CommandCounters *cc )
+{
+    Map* map = makeDriverMap(opts, 1);
+    Profile *profile = NULL;
+    if (opts->profile) {
+        profile = (Profile *) malloc(sizeof(Profile));
+        initProfile(profile);
+    }
+    Output out;
+    initOutput(&out);
+    if (!opts->batch) {
+        printf("cmd> ");
+    }
+
+    char *line;
+    while ((line = readLine(NULL)) != NULL) {
+        out.len = 0;
+        bool timed = dumped, during = dump.pid > 0;
+        long start = timed ? profileClock() : 0;
+        CommandType type = timedCommand(map, line, &out, profile, cc);
+        if (type == CMD_LATENCY) {
+            latencyCommand(profile, &out);
+        } else if (type == CMD_BGSAVE) {
+            bgsaveCommand(&map, 1, line, &out);
+        }
+        if (timed) {
+            dumpLatency(profileClock() - start, during);
+        }
+        finishDump(false);
+        respond(opts, line, out.text, out.len, type != CMD_QUIT);
+        free(line);
+        if (type == CMD_QUIT) {
+            break;
+        }
+    }
+    finishDump(true);
+    exitReport(profile);
+    internReport(opts);
+    free(profile);
+    freeOutput(&out);
+    freeMap(map);
+}
+
+/**
+Reader thread for pipelined mode.  Reads and parses commands, passing them to
+the executor, and stops after quit or at the end of the input.
+@param arg the Pipeline
+@return NULL
+*/
+static void *runReader( void *arg )
+{
+    Pipeline *p = (Pipeline *) arg;
+    openCommandCounters(p->readerCounters);
+    char *line;
+    while ((line = readLine(NULL)) != NULL) {
+        Job *job = (Job *) poolAlloc(&jobPool);
+        job->line = line;
+        job->report.text = NULL;
+        parseCommand(line, &job->cmd);
+        ringPush(&p->parsed, job);
+        if (job->cmd.type == CMD_QUIT) {
+            break;
+        }
+    }
+    ringPush(&p->parsed, NULL);
+    closeCommandCounters(p->readerCounters);
+    return NULL;
+}
+
+/**
+Writer thread for pipelined mode.  Formats the responses the executor left,
+and prints them in order.
+@param arg the Pipeline
+@return NULL
+*/
+static void *runWriter( void *arg )
+{
+    Pipeline *p = (Pipeline *) arg;
+    openCommandCounters(p->writerCounters);
+    Output out;
+    initOutput(&out);
+    if (!p->opts->batch) {
+        printf("cmd> ");
+    }
+    Job *job;
+    while ((job = (Job *) ringPop(&p->done)) != NULL) {
+        out.len = 0;
+        appendResult(&out, &job->result);
+        if (job->report.text != NULL) {
+            appendOutput(&out, job->report.text, job->report.len);
+            freeOutput(&job->report);
+        }
+        respond(p->opts, job->line, out.text, out.len, job->cmd.type != CMD_QUIT);
+        free(job->line);
+        poolFree(&jobPool, job);
+    }
+    freeOutput(&out);
+    closeCommandCounters(p->writerCounters);
+    return NULL;
+}
+
+/**
+Runs commands with reading and parsing, running, and formatting and printing
+each on its own thread, so they overlap.  This thread runs the commands, so
+the map only ever has one thread using it, and the responses come out in the
+same order and form as in sequential mode.  Latencies cover just running the
+commands, not parsing them, and so do the counts for each type of command;
+the reader's and writer's counts are only added in to the whole run's.
+@param opts the settings from the command line
+@param cc counters for this thread, or NULL
+*/
+static void runPipelined( Options const *opts, CommandCounters *cc )
+{
+    Map *map = makeDriverMap(opts, 1);
+    Profile *profile = NULL;
+    if (opts->profile) {
+        profile = (Profile *) malloc(sizeof(Profile));
+        initProfile(profile);
+    }
+    Pipeline p;
+    initRing(&p.parsed, PIPELINE_DEPTH);
+    initRing(&p.done, PIPELINE_DEPTH);
+    p.opts = opts;
+    p.readerCounters = makeCommandCounters(opts);
+    p.writerCounters = makeCommandCounters(opts);
+    pthread_t reader, writer;
+    pthread_create(&reader, NULL, runReader, &p);
+    pthread_create(&writer, NULL, runWriter, &p);
+
+    Job *job;
+    while ((job = (Job *) ringPop(&p.parsed)) != NULL) {
+        bool timed = dumped, during = dump.pid > 0;
+        CounterSample counts;
+        long start = timed || profile != NULL || cc != NULL ? startCommand(cc, &counts) : 0;
+        runCommand(map, &job->cmd, &job->result);
+        CommandType type = job->cmd.type;
+        if (profile != NULL || cc != NULL) {
+            finishCommand(profile, cc, type, start, &counts);
+        }
+        if (type == CMD_LATENCY) {
+            initOutput(&job->report);
+            latencyCommand(profile, &job->report);
+        } else if (type == CMD_BGSAVE) {
+            initOutput(&job->report);
+            bgsaveCommand(&map, 1, job->line, &job->report);
+        }
+        if (timed) {
+            dumpLatency(profileClock() - start, during);
+        }
+        finishDump(false);
+        ringPush(&p.done, job);
+    }
+    ringPush(&p.done, NULL);
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    if (cc != NULL) {
+        mergeCommandCounters(cc, p.readerCounters);
+        mergeCommandCounters(cc, p.writerCounters);
+    }
+    free(p.readerCounters);
+    free(p.writerCounters);
+
+    finishDump(true);
+    exitReport(profile);
+    internReport(opts);
+    free(profile);
+    freeRing(&p.parsed);
+    freeRing(&p.done);
+    freeMap(map);
+}
+
+/**
+Decides which partition a command belongs to.  Commands on a single key go to
+the partition picked by a hash of the key, so each key always lives in the
+same map.  Anything else waits for all the earlier commands.
+@param cmd the parsed command
+@param threads number of partitions
+@return the partition, or -1 if the command can't run in parallel
+*/
+static int partitionOf( ParsedCommand const *cmd, int threads )
+{
+    switch (cmd->type) {
+    case CMD_SET:
+    case CMD_GET:
+    case CMD_REMOVE:
+    case CMD_PLUS:
+        break;
+    default:
+        return -1;
+    }
+    if (cmd->argStart < 0) {
+        return -1;
+    }
+    char key[cmd->argLen + 1];
+    memcpy(key, cmd->line + cmd->argStart, cmd->argLen);
+    key[cmd->argLen] = '\0';
+    return mapHashKey(key) % threads;
+}
+
+/**
+Runs a parsed command against a map split across several partitions,
+recording its latency if there's a profile and its events if there are
+counters
+@param maps the partitions' maps
+@param count number of maps
+@param cmd the parsed command
+@param out buffer for the command's response
+@param profile profile to record the latency in, or NULL
+@param cc counters for the thread, or NULL
+*/
+static void runParsed( Map *maps[], int count, ParsedCommand *cmd, Output *out,
+                       Profile *profile, CommandCounters *cc )
+{
+    CommandResult res;
+    CounterSample counts;
+    long start = profile != NULL || cc != NULL ? startCommand(cc, &counts) : 0;
+    runCommandOnMaps(maps, count, cmd, &res);
+    appendResult(out, &res);
+    if (profile != NULL || cc != NULL) {
+        finishCommand(profile, cc, cmd->type, start, &counts);
+    }
+}
+
+/**
+Worker thread for parallel mode.  For each segment, runs this partition's
+commands from the segment in order, then waits for the next one.
+@param arg the Worker for this thread
+@return NULL
+*/
+static void *runWorker( void *arg )
+{
+    Worker *w = (Worker *) arg;
+    Replay *r = w->replay;
+    openCommandCounters(w->counters);
+    for (;;) {
+        pthread_barrier_wait(&r->start);
+        if (r->stop) {
+            closeCommandCounters(w->counters);
+            return NULL;
+        }
+        while (w->next < w->count && w->mine[w->next] < r->end) {
+            Command *c = &r->cmds[w->mine[w->next++]];
+            c->outStart = w->out.len;
+            runParsed(&w->map, 1, &c->cmd, &w->out, w->profile, w->counters);
+            c->outLen = w->out.len - c->outStart;
+        }
+        pthread_barrier_wait(&r->done);
+    }
+}
+
+/**
+Reads all the commands, then replays them on several threads.  Commands are
+partitioned by key, each partition has its own map, and a command that isn't
+on a single key (like size) acts as a barrier between segments that run in
+parallel, running against every partition's map.  Responses are printed in the
+original order, exactly as in sequential mode.  Latencies cover just running
+the commands, since they're all parsed as they're read.
+@param opts the settings from the command line
+@param cc counters for this thread, or NULL
+*/
+static void runParallel( Options const *opts, CommandCounters *cc )
+{
+    int threads = opts->threads;
+    Worker workers[MAX_THREADS];
+    Map *maps[MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        workers[t].map = makeDriverMap(opts, threads);
+        maps[t] = workers[t].map;
+        workers[t].count = 0;
+        workers[t].cap = INITIAL_CAPACITY;
+        workers[t].mine = (int *) malloc(workers[t].cap * sizeof(int));
+        workers[t].next = 0;
+        initOutput(&workers[t].out);
+        workers[t].profile = NULL;
+        if (opts->profile) {
+            workers[t].profile = (Profile *) malloc(sizeof(Profile));
+            initProfile(workers[t].profile);
+        }
+        workers[t].counters = makeCommandCounters(opts);
+    }
+
+    // Latencies for the barrier commands, and for reports covering everything.
+    Profile *profile = NULL, *merged = NULL;
+    if (opts->profile) {
+        profile = (Profile *) malloc(sizeof(Profile));
+        merged = (Profile *) malloc(sizeof(Profile));
+        initProfile(profile);
+    }
+
+    // Read everything, handing out the commands to partitions.
+    int count = 0, cap = INITIAL_CAPACITY;
+    Command *cmds = (Command *) malloc(cap * sizeof(Command));
+    char *line;
+    while ((line = readLine(NULL)) != NULL) {
+        if (count >= cap) {
+            cap *= INCREASE_FACTOR;
+            cmds = (Command *) realloc(cmds, cap * sizeof(Command));
+        }
+        Command *c = &cmds[count];
+        c->line = line;
+        parseCommand(line, &c->cmd);
+        c->part = partitionOf(&c->cmd, threads);
+        c->outLen = 0;
+        if (c->part >= 0) {
+            Worker *w = &workers[c->part];
+            if (w->count >= w->cap) {
+                w->cap *= INCREASE_FACTOR;
+                w->mine = (int *) realloc(w->mine, w->cap * sizeof(int));
+            }
+            w->mine[w->count++] = count;
+        }
+        count++;
+    }
+
+    Replay replay;
+    replay.cmds = cmds;
+    replay.stop = false;
+    pthread_barrier_init(&replay.start, NULL, threads + 1);
+    pthread_barrier_init(&replay.done, NULL, threads + 1);
+    pthread_t tids[MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        workers[t].replay = &replay;
+        pthread_create(&tids[t], NULL, runWorker, &workers[t]);
+    }
+
+    Output barrierOut;
+    initOutput(&barrierOut);
+    if (!opts->batch) {
+        printf("cmd> ");
+    }
+    int begin = 0;
+    bool more = true;
+    while (more && begin < count) {
+        // Run everything up to the next barrier command in parallel.
+        int end = begin;
+        while (end < count && cmds[end].part >= 0) {
+            end++;
+        }
+        if (end > begin) {
+            for (int t = 0; t < threads; t++) {
+                workers[t].out.len = 0;
+            }
+            replay.end = end;
+            pthread_barrier_wait(&replay.start);
+            pthread_barrier_wait(&replay.done);
+            for (int i = begin; i < end; i++) {
+                Output *o = &workers[cmds[i].part].out;
+                respond(opts, cmds[i].line, o->text + cmds[i].outStart, cmds[i].outLen, true);
+            }
+        }
+
+        // Then the barrier, on this thread.
+        if (end < count) {
+            barrierOut.len = 0;
+            runParsed(maps, threads, &cmds[end].cmd, &barrierOut, profile, cc);
+            CommandType type = cmds[end].cmd.type;
+            more = type != CMD_QUIT;
+            if (type == CMD_LATENCY && merged != NULL) {
+                *merged = *profile;
+                for (int t = 0; t < threads; t++) {
+                    mergeProfile(merged, workers[t].profile);
+                }
+                latencyCommand(merged, &barrierOut);
+            } else if (type == CMD_LATENCY) {
+                latencyCommand(NULL, &barrierOut);
+            } else if (type == CMD_BGSAVE) {
+                bgsaveCommand(maps, threads, cmds[end].line, &barrierOut);
+            }
+            respond(opts, cmds[end].line, barrierOut.text, barrierOut.len, more);
+            end++;
+        }
+        begin = end;
+        finishDump(false);
+    }
+
+    replay.stop = true;
+    pthread_barrier_wait(&replay.start);
+    finishDump(true);
+    internReport(opts);
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        if (profile != NULL) {
+            mergeProfile(profile, workers[t].profile);
+        }
+        free(workers[t].profile);
+        if (cc != NULL) {
+            mergeCommandCounters(cc, workers[t].counters);
+        }
+        free(workers[t].counters);
+        freeOutput(&workers[t].out);
+        freeMap(workers[t].map);
+        free(workers[t].mine);
+    }
+    exitReport(profile);
+    free(profile);
+    free(merged);
+    pthread_barrier_destroy(&replay.start);
+    pthread_barrier_destroy(&replay.done);
+    freeOutput(&barrierOut);
+    for (int i = 0; i < count; i++) {
+        // Commands after a quit never ran, so they still own their values.
+        if (cmds[i].cmd.val != NULL) {
+            cmds[i].cmd.val->destroy(cmds[i].cmd.val);
+        }
+        free(cmds[i].line);
+    }
+    free(cmds);
+}
+
+/**
+The main method
+@param argc number of command-line arguments
+@param argv the command-line arguments
+@return whether the program was run successfully
+*/
+int main( int argc, char *argv[] )
+{
+    Options opts = { 0, 0, 0, 0, false, false, false, false, false, false };
+    char extra;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%ld%c", &opts.limit, &extra) != 1 || opts.limit <= 0) {
+                usage();
+            }
+        } else if (strcmp(argv[i], "--front-cache") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d%c", &opts.frontEntries, &extra) != 1 || opts.frontEntries <= 0) {
+                usage();
+            }
+        } else if (strcmp(argv[i], "--bloom") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d%c", &opts.bloomBits, &extra) != 1 ||
+                opts.bloomBits <= 0 || opts.bloomBits > 64) {
+                usage();
+            }
+        } else if (strcmp(argv[i], "--shortest") == 0) {
+            setDoubleFormat(DOUBLE_SHORTEST);
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            opts.profile = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            opts.batch = true;
+        } else if (strcmp(argv[i], "--intern") == 0) {
+            setStringInterning(true);
+            opts.intern = true;
+        } else if (strcmp(argv[i], "--background-free") == 0) {
+            opts.backgroundFree = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            opts.pipeline = true;
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            opts.perfCounters = true;
+        } else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d%c", &opts.threads, &extra) != 1 ||
+                opts.threads <= 0 || opts.threads > MAX_THREADS) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+    if (opts.threads > 0 && opts.pipeline) {
+        usage();
+    }
+
+    if (opts.batch) {
+        pending.len = 0;
+        pending.cap = BATCH_CHUNK;
+        pending.text = (char *) malloc(pending.cap);
+    }
+
+    // The whole run is counted on this thread, from here until the output
+    // has all been written.
+    CommandCounters *cc = makeCommandCounters(&opts);
+    openCommandCounters(cc);
+    if (opts.threads > 0) {
+        runParallel(&opts, cc);
+    } else if (opts.pipeline) {
+        runPipelined(&opts, cc);
+    } else {
+        runSequential(&opts, cc);
+    }
+    if (opts.batch) {
+        flushBatch();
+        freeOutput(&pending);
+    }
+    closeCommandCounters(cc);
+    countersReport(cc);
+    free(cc);
+    free(dump.file);
+    return EXIT_SUCCESS;
+}
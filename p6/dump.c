@@ -0,0 +1,145 @@
+/**
+@file dump
+@author Ethan Browne, efbrowne
+Writes the contents of maps to a file as set commands, through a large
+buffer, either directly or from a forked child process.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "dump.h"
+#include "value.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/** Size of the buffer dumped entries are collected in before each write. */
+#define DUMP_BUFFER ( 1 << 20 )
+
+/** A dump file being written. */
+typedef struct {
+  /** File descriptor for the file. */
+  int fd;
+
+  /** Text waiting to be written. */
+  char *buf;
+
+  /** Number of characters in buf. */
+  int len;
+
+  /** Number of keys dumped so far. */
+  long keys;
+
+  /** True once a write has failed. */
+  bool failed;
+} DumpFile;
+
+/**
+Writes all of a block of text to the dump file, unless an earlier write failed
+@param f the dump file
+@param str the text
+@param len number of characters in the text
+*/
+static void writeAll( DumpFile *f, char const *str, size_t len )
+{
+  while ( len > 0 && !f->failed ) {
+    ssize_t n = write( f->fd, str, len );
+    if ( n < 0 ) {
+      if ( errno != EINTR )
+        f->failed = true;
+      continue;
+    }
+    str += n;
+    len -= n;
+  }
+}
+
+/**
+Adds text to the dump file's buffer, writing out the buffer when it fills up.
+Text too long for the buffer is written directly.
+@param f the dump file
+@param str the text
+@param len number of characters in the text
+*/
+static void dumpText( DumpFile *f, char const *str, size_t len )
+{
+  if ( f->len + len > DUMP_BUFFER ) {
+    writeAll( f, f->buf, f->len );
+    f->len = 0;
+    if ( len > DUMP_BUFFER ) {
+      writeAll( f, str, len );
+      return;
+    }
+  }
+  memcpy( f->buf + f->len, str, len );
+  f->len += len;
+}
+
+/**
+Adds one key and its value to the dump, as a set command.  Used as the
+visitor for mapForEach().
+@param key the key
+@param val the key's value
+@param arg the DumpFile
+*/
+static void dumpEntry( char const *key, Value const *val, void *arg )
+{
+  DumpFile *f = (DumpFile *) arg;
+  dumpText( f, "set ", 4 );
+  dumpText( f, key, strlen( key ) );
+  dumpText( f, " ", 1 );
+
+  // The default format for doubles loses digits, so use one that doesn't.
+  // It's passed in rather than set, since another thread may be
+  // formatting doubles for output.
+  double x;
+  if ( doubleValue( val, &x ) ) {
+    char buffer[ DOUBLE_LENGTH + 1 ];
+    dumpText( f, buffer, formatDoubleAs( x, DOUBLE_SHORTEST, buffer ) );
+  } else {
+    char *str = val->toString( val );
+    dumpText( f, str, strlen( str ) );
+    free( str );
+  }
+  dumpText( f, "\n", 1 );
+  f->keys++;
+}
+
+long dumpMaps( Map *maps[], int count, char const *file )
+{
+  char temp[ strlen( file ) + 5 ];
+  sprintf( temp, "%s.tmp", file );
+  DumpFile f = { open( temp, O_WRONLY | O_CREAT | O_TRUNC, 0644 ), NULL, 0, 0, false };
+  if ( f.fd < 0 )
+    return -1;
+  f.buf = (char *) malloc( DUMP_BUFFER );
+
+  for ( int i = 0; i < count; i++ )
+    mapForEach( maps[ i ], dumpEntry, &f );
+
+  writeAll( &f, f.buf, f.len );
+  free( f.buf );
+  if ( fsync( f.fd ) != 0 )
+    f.failed = true;
+  if ( close( f.fd ) != 0 )
+    f.failed = true;
+  if ( f.failed || rename( temp, file ) != 0 ) {
+    unlink( temp );
+    return -1;
+  }
+  return f.keys;
+}
+
+pid_t forkDump( Map *maps[], int count, char const *file )
+{
+  pid_t pid = fork();
+  if ( pid == 0 ) {
+    // Leave without flushing stdio buffers, which still belong to the parent.
+    _exit( dumpMaps( maps, count, file ) < 0 ? EXIT_FAILURE : EXIT_SUCCESS );
+  }
+  return pid;
+}
@@ -0,0 +1,36 @@
+/**
+@file dump
+@author Ethan Browne, efbrowne
+Writes the contents of maps to a file as set commands, so feeding the file
+back to the driver rebuilds them.  A dump can be written directly, or by a
+forked child process that works from a copy-on-write image of the maps while
+the parent keeps running commands.
+*/
+
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "map.h"
+#include <sys/types.h>
+
+/** Write every key and value in the given maps to a file, one set command
+    per line.  Doubles are written with the fewest digits that convert back
+    to the same value.  The dump goes to a temporary file that's renamed
+    over the given one when it's complete, so a failed dump never leaves a
+    partial file behind.
+    @param maps the maps to dump.
+    @param count number of maps.
+    @param file name of the file to write.
+    @return number of keys written, or -1 if the file couldn't be written. */
+long dumpMaps( Map *maps[], int count, char const *file );
+
+/** Start a child process that dumps the given maps with dumpMaps() and
+    exits, successfully if the dump was written.  The parent can keep
+    changing the maps; the child sees them as they were at the fork.
+    @param maps the maps to dump.
+    @param count number of maps.
+    @param file name of the file to write.
+    @return process id of the child, or -1 if it couldn't be started. */
+pid_t forkDump( Map *maps[], int count, char const *file );
+
+#endif
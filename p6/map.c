@@ -4,9 +4,17 @@
 Contains all of the map related functions
 */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include "map.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "value.h"
 
 /** Lowest-numbered symbol ina  key. */
@@ -15,24 +23,283 @@ Contains all of the map related functions
 /** Number of possible symbols in a key. */
 #define SYM_COUNT ( '~' - '!' + 1 )
 
+/** Number of lookups mapGetBatch() keeps in progress at once. */
+#define BATCH_LANES 16
+
+/** Initial number of entries in the eviction clock of a size-limited map. */
+#define INITIAL_CLOCK 16
+
+/** Number of 64-bit words in a Bloom filter block, filling one cache line.
+    Each key sets one bit in every word of its block. */
+#define BLOOM_WORDS 8
+
+/** Fewest keys a Bloom filter is sized for. */
+#define MIN_BLOOM_KEYS 16384
+
+/** A Bloom filter is sized for this many times the keys in the map when
+    it's built, so a growing map isn't rebuilding it every time it doubles. */
+#define BLOOM_HEADROOM 4
+
+/** Starting value for the 64-bit FNV-1a hash of a key. */
+#define BLOOM_SEED 0xcbf29ce484222325ULL
+
+/** Size and alignment of a chunk of nodes packed by mapOptimizeLayout(), the
+    size of a huge page, so a packed node finds its chunk by masking its
+    address. */
+#define LAYOUT_CHUNK ( 2 << 20 )
+
+/** Space between packed nodes, rounded up to a cache line so a node's
+    counts and value pointer share the line its first children are on. */
+#define LAYOUT_STRIDE ( ( sizeof( Node ) + 63 ) / 64 * 64 )
+
+/** Number of nodes that fit in a chunk, after its header line. */
+#define LAYOUT_NODES ( ( LAYOUT_CHUNK - 64 ) / LAYOUT_STRIDE )
+
 /** Short name for the node used to build this tree. */
 typedef struct NodeStruct Node;
 
 /** Node in the trie data structure. */
 struct NodeStruct {
+  /** Number of parent nodes, maps and snapshots pointing to this node.  Nodes
+      with more than one reference are shared between versions of the map and
+      are copied before they are modified. */
+  int refs;
+
+  /** Number of non-NULL entries in the child array. */
+  short kids;
+
+  /** True if this node was moved into a chunk by mapOptimizeLayout(),
+      rather than allocated on its own. */
+  bool packed;
+
+  /** Number of keys in the subtree rooted at this node, including this
+      node's own key. */
+  int keys;
+
+  /** For a key in a size-limited map, index of the key's entry in the
+      eviction clock, otherwise -1. */
+  int slot;
+
+  /** Index of the front cache entry that may point to this node, or -1. */
+  int front;
+
+  /** Number of double values in the subtree rooted at this node. */
+  int dcount;
+
+  /** Sum of the integer values in the subtree rooted at this node. */
+  long isum;
+
+  /** Sum of the double values in the subtree rooted at this node. */
+  double dsum;
+
+  /** Rounding error left out of dsum.  The sum of the doubles is
+      dsum + derr, kept to about twice the precision of a double. */
+  double derr;
+
   /** If the substring to the root of the tree up to this node is a
       key, this is the value that goes with it. */
   Value *val;
-  
+
   /** Array of pointers to child nodes. */
   Node *child[ SYM_COUNT ];
 };
 
+/** Entry in the eviction clock, for one key in a size-limited map. */
+typedef struct {
+  /** Copy of the key, or NULL if this entry is unused. */
+  char *key;
+
+  /** Set whenever the key is used, and cleared as the clock hand passes. */
+  bool used;
+} ClockEntry;
+
+/** Entry in the front cache, remembering the node for one recently used key. */
+typedef struct {
+  /** Hash of the key. */
+  unsigned hash;
+
+  /** Copy of the key, with room for keyCap characters. */
+  char *key;
+
+  /** Capacity of the key buffer. */
+  int keyCap;
+
+  /** Node for the key, or NULL if this entry is unused. */
+  Node *node;
+} FrontEntry;
+
+/** Start of a chunk of nodes packed by mapOptimizeLayout().  The nodes
+    follow, starting on the next cache line. */
+typedef struct {
+  /** Number of nodes in the chunk that haven't been freed, updated
+      atomically.  The chunk is freed along with its last node. */
+  long live;
+} Chunk;
+
+/** A mapOptimizeLayout() pass, filling chunks with nodes in order. */
+typedef struct {
+  /** Chunk being filled, or NULL before the first node. */
+  char *chunk;
+
+  /** Number of nodes placed in the current chunk. */
+  int used;
+
+  /** Number of nodes moved so far. */
+  int moved;
+} Layout;
+
+/** Subtree waiting to be freed by a map's reaper thread. */
+typedef struct ReapStruct {
+  /** Root of the detached subtree. */
+  Node *root;
+
+  /** Next subtree in the queue. */
+  struct ReapStruct *next;
+} Reap;
+
+/** One cache line of a blocked Bloom filter. */
+typedef struct {
+  uint64_t word[ BLOOM_WORDS ];
+} BloomBlock;
+
+/** Blocked Bloom filter of the keys in a map.  Each key's hash picks one
+    block, and sets one bit in each of the block's words, so a test reads
+    a single cache line. */
+typedef struct {
+  /** The blocks, aligned to a cache line, or NULL if there's no filter. */
+  BloomBlock *blocks;
+
+  /** Number of blocks minus one, for masking hash values. */
+  uint64_t mask;
+
+  /** Number of keys the filter was sized for. */
+  long capacity;
+
+  /** Number of keys added to the filter. */
+  long keys;
+
+  /** Number of keys in the filter that have since been removed from the
+      map.  The filter still lets them through. */
+  long stale;
+} Bloom;
+
+/** A Bloom filter being rebuilt on a background thread from a pinned
+    version of the trie. */
+typedef struct {
+  /** Root of the trie when the rebuild started, retained so it doesn't
+      change while the thread reads it. */
+  Node *root;
+
+  /** The new filter. */
+  Bloom filter;
+
+  /** Thread filling in the new filter. */
+  pthread_t thread;
+
+  /** Set by the thread, atomically, when the new filter is ready. */
+  int done;
+
+  /** Hashes of the keys added to the map since the rebuild started, to be
+      added to the new filter when it's installed. */
+  uint64_t *added;
+
+  /** Number of hashes in added, and its capacity. */
+  int addedCount, addedCap;
+
+  /** Number of keys removed from the map since the rebuild started. */
+  long removed;
+} BloomBuild;
+
 /** Representation of a trie implementation of a map. */
 struct MapStruct {
   /** Root node of this tree. */
   Node *root;
   int size;
+
+  /** Maximum number of bytes the map may use, or 0 if there's no limit. */
+  size_t limit;
+
+  /** Bytes used by the nodes, values and keys in the map. */
+  size_t bytes;
+
+  /** For a size-limited map, one entry per key, swept in a circle to find
+      keys that haven't been used recently. */
+  ClockEntry *clock;
+
+  /** Capacity of the clock array. */
+  int clockCap;
+
+  /** Next clock entry to look at when choosing a key to evict. */
+  int hand;
+
+  /** Stack of indices of unused clock entries. */
+  int *freeSlots;
+
+  /** Number of indices on the freeSlots stack. */
+  int freeCount;
+
+  /** Direct-mapped cache from key hashes to the nodes for popular keys, so
+      mapGet() can skip the walk from the root, or NULL if not enabled. */
+  FrontEntry *front;
+
+  /** Number of front cache entries minus one, for masking hash values. */
+  unsigned frontMask;
+
+  /** Number of mapGet() calls answered by the front cache. */
+  long frontHits;
+
+  /** Number of mapGet() calls the front cache couldn't answer. */
+  long frontMisses;
+
+  /** True if mapRemovePrefix() hands subtrees to the reaper thread. */
+  bool background;
+
+  /** True once the reaper thread has been started. */
+  bool reaping;
+
+  /** Thread that frees removed subtrees in the background. */
+  pthread_t reaper;
+
+  /** Lock for the reaper's queue and flags. */
+  pthread_mutex_t reapLock;
+
+  /** Signaled when there's work for the reaper or it should stop. */
+  pthread_cond_t reapReady;
+
+  /** Subtrees waiting to be freed. */
+  Reap *reapQueue;
+
+  /** Set when the reaper should exit once the queue is empty. */
+  bool reapStop;
+
+  /** Bytes the reaper has freed that haven't been taken off bytes yet,
+      updated atomically. */
+  size_t reaped;
+
+  /** Bloom filter checked before walking the trie for a lookup. */
+  Bloom bloom;
+
+  /** Bits per key the Bloom filter is sized for, or 0 if it's off. */
+  int bloomBits;
+
+  /** Rebuild of the Bloom filter in progress, or NULL. */
+  BloomBuild *bloomBuild;
+
+  /** Number of lookups the Bloom filter turned away. */
+  long bloomRejected;
+
+  /** Number of lookups the Bloom filter let through for missing keys. */
+  long bloomFalse;
+
+  /** Number of times the Bloom filter has been rebuilt. */
+  long bloomRebuilds;
+};
+
+/** Read-only version of a map, sharing its nodes with the map it came from. */
+struct SnapshotStruct {
+  /** Root node of the map at the time the snapshot was taken. */
+  Node *root;
+  int size;
 };
 
 /**
@@ -44,6 +311,49 @@ Map *makeMap()
   Map *m = (Map *) malloc( sizeof( Map ) );
   m->root = NULL;
   m->size = 0;
+  m->limit = 0;
+  m->bytes = 0;
+  m->clock = NULL;
+  m->clockCap = 0;
+  m->hand = 0;
+  m->freeSlots = NULL;
+  m->freeCount = 0;
+  m->front = NULL;
+  m->frontMask = 0;
+  m->frontHits = 0;
+  m->frontMisses = 0;
+  m->background = false;
+  m->reaping = false;
+  pthread_mutex_init(&m->reapLock, NULL);
+  pthread_cond_init(&m->reapReady, NULL);
+  m->reapQueue = NULL;
+  m->reapStop = false;
+  m->reaped = 0;
+  m->bloom.blocks = NULL;
+  m->bloomBits = 0;
+  m->bloomBuild = NULL;
+  m->bloomRejected = 0;
+  m->bloomFalse = 0;
+  m->bloomRebuilds = 0;
+  return m;
+}
+
+/**
+Makes an empty map that evicts keys to stay within the given number of bytes
+@param bytes the most memory the map's nodes, values and keys may use
+@return a pointer to the map
+*/
+Map *makeMapWithLimit( size_t bytes )
+{
+  Map *m = makeMap();
+  m->limit = bytes;
+  m->clockCap = INITIAL_CLOCK;
+  m->clock = (ClockEntry *) malloc( m->clockCap * sizeof( ClockEntry ) );
+  m->freeSlots = (int *) malloc( m->clockCap * sizeof( int ) );
+  for (int i = 0; i < m->clockCap; i++){
+    m->clock[i].key = NULL;
+    m->freeSlots[m->freeCount++] = m->clockCap - 1 - i;
+  }
   return m;
 }
 
@@ -56,6 +366,183 @@ int mapSize( Map *m )
   return m->size;
 }
 
+/**
+Function returns the number of bytes used by the nodes, values and keys in the map
+@return the bytes used by the map
+*/
+size_t mapBytes( Map *m )
+{
+  m->bytes -= __atomic_exchange_n(&m->reaped, 0, __ATOMIC_ACQ_REL);
+  return m->bytes;
+}
+
+/**
+Turns on the front cache for mapGet(), replacing any existing one and
+resetting its statistics
+@param m the map
+@param entries number of cache entries, rounded up to a power of two
+*/
+void mapEnableFrontCache( Map *m, int entries )
+{
+  mapDisableFrontCache(m);
+  unsigned size = 1;
+  while (size < (unsigned) entries) {
+    size *= 2;
+  }
+  m->front = (FrontEntry *) calloc( size, sizeof( FrontEntry ) );
+  m->frontMask = size - 1;
+  m->frontHits = 0;
+  m->frontMisses = 0;
+}
+
+/**
+Turns off the front cache, freeing its memory
+@param m the map
+*/
+void mapDisableFrontCache( Map *m )
+{
+  if (m->front == NULL) {
+    return;
+  }
+  for (unsigned i = 0; i <= m->frontMask; i++){
+    if (m->front[i].node != NULL) {
+      m->front[i].node->front = -1;
+    }
+    free(m->front[i].key);
+  }
+  free(m->front);
+  m->front = NULL;
+  m->frontMask = 0;
+}
+
+/**
+Reports how well the front cache is working
+@param m the map
+@param hits returns the number of lookups answered by the cache
+@param misses returns the number of lookups that had to walk the trie
+*/
+void mapFrontCacheStats( Map *m, long *hits, long *misses )
+{
+  *hits = m->frontHits;
+  *misses = m->frontMisses;
+}
+
+/**
+Hashes a key with 32-bit FNV-1a, for the front cache
+@param key the key
+@return hash of the key
+*/
+unsigned mapHashKey( char const *key )
+{
+  unsigned h = 2166136261u;
+  for (int i = 0; key[i]; i++){
+    h = ( h ^ (unsigned char) key[i] ) * 16777619u;
+  }
+  return h;
+}
+
+/**
+Adds one more key character to a 64-bit FNV-1a hash
+@param h hash of the characters so far, starting from BLOOM_SEED
+@param c the next character
+@return the new hash
+*/
+static uint64_t bloomStep( uint64_t h, char c )
+{
+  return ( h ^ (unsigned char) c ) * 0x100000001b3ULL;
+}
+
+/**
+Mixes the bits of a finished FNV-1a hash, so every bit of the result depends
+on every character
+@param h the hash
+@return the mixed hash, used to pick bits in the Bloom filter
+*/
+static uint64_t bloomMix( uint64_t h )
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+Hashes a key for the Bloom filter
+@param key the key
+@return hash of the key
+*/
+static uint64_t bloomHash( char const *key )
+{
+  uint64_t h = BLOOM_SEED;
+  for (int i = 0; key[i]; i++){
+    h = bloomStep(h, key[i]);
+  }
+  return bloomMix(h);
+}
+
+/**
+Makes an empty Bloom filter
+@param capacity number of keys the filter should hold
+@param bits number of bits per key
+@return the filter
+*/
+static Bloom makeBloom( long capacity, int bits )
+{
+  Bloom b;
+  if (capacity < MIN_BLOOM_KEYS) {
+    capacity = MIN_BLOOM_KEYS;
+  }
+  uint64_t blocks = 1;
+  while (blocks * sizeof( BloomBlock ) * 8 < (uint64_t) capacity * bits) {
+    blocks *= 2;
+  }
+  void *mem;
+  if (posix_memalign(&mem, sizeof( BloomBlock ), blocks * sizeof( BloomBlock )) != 0) {
+    abort();
+  }
+  memset(mem, 0, blocks * sizeof( BloomBlock ));
+  b.blocks = (BloomBlock *) mem;
+  b.mask = blocks - 1;
+  b.capacity = capacity;
+  b.keys = 0;
+  b.stale = 0;
+  return b;
+}
+
+/**
+Adds a key to a Bloom filter
+@param b the filter
+@param h the key's hash
+*/
+static void bloomAdd( Bloom *b, uint64_t h )
+{
+  BloomBlock *block = &b->blocks[h & b->mask];
+  uint64_t bits = h * 0x9e3779b97f4a7c15ULL;
+  for (int i = 0; i < BLOOM_WORDS; i++){
+    block->word[i] |= 1ULL << ( ( bits >> ( 16 + 6 * i ) ) & 63 );
+  }
+}
+
+/**
+Checks whether a key might be in a Bloom filter.  The words are tested
+without branches, so the loop can be vectorized.
+@param b the filter
+@param h the key's hash
+@return false if the key is definitely not in the filter
+*/
+static bool bloomTest( Bloom const *b, uint64_t h )
+{
+  BloomBlock const *block = &b->blocks[h & b->mask];
+  uint64_t bits = h * 0x9e3779b97f4a7c15ULL;
+  uint64_t missing = 0;
+  for (int i = 0; i < BLOOM_WORDS; i++){
+    missing |= ~block->word[i] & ( 1ULL << ( ( bits >> ( 16 + 6 * i ) ) & 63 ) );
+  }
+  return missing == 0;
+}
+
 /**
 Allocates space for a node and initializes its fields
 @return the node
@@ -63,6 +550,16 @@ Allocates space for a node and initializes its fields
 Node* initializeNode()
 {
     Node *n = (Node *) malloc( sizeof( Node ) );
+    n->refs = 1;
+    n->kids = 0;
+    n->packed = false;
+    n->keys = 0;
+    n->dcount = 0;
+    n->isum = 0;
+    n->dsum = 0;
+    n->derr = 0;
+    n->slot = -1;
+    n->front = -1;
     n->val = NULL;
     for (int i = 0; i < SYM_COUNT; i++){
       (n->child)[i] = NULL;
@@ -71,115 +568,1296 @@ Node* initializeNode()
 }
 
 /**
-Adds the given key / value pair to the given map
-If the key is already in the map, it replaces its value with the given value
-The map will take ownership of the given value object (but not the key)
-It can use the value as part of its representation and it’s responsible for freeing it when it’s no longer needed.
-@param m the map
-@param key the key
-@param val the value
+Returns the child index for the given key character
+@param c the key character
+@return index of c in a node's child array, or -1 if c can't be in a key
 */
-void mapSet( Map *m, char const *key, Value *val )
+static int symIndex( char c )
 {
-  Node **n = &m->root;
-  for (int i = 0; key[i]; i++){
-    if (*n == NULL) {
-      *n = initializeNode();
+  if (c < FIRST_SYM || c - FIRST_SYM >= SYM_COUNT) {
+    return -1;
+  }
+  return c - FIRST_SYM;
+}
+
+/**
+Adds a reference to the given node, so it will be shared rather than freed
+@param n the node to retain
+*/
+static void retainNode( Node *n )
+{
+  __atomic_add_fetch( &n->refs, 1, __ATOMIC_RELAXED );
+}
+
+/**
+Gives back the memory for a node that's no longer used.  A packed node is
+counted out of its chunk, and the chunk is freed with its last node.
+@param n the node
+*/
+static void freeNode( Node *n )
+{
+  if (!n->packed) {
+    free(n);
+    return;
+  }
+  Chunk *c = (Chunk *) ( (uintptr_t) n & ~( (uintptr_t) LAYOUT_CHUNK - 1 ) );
+  if (__atomic_sub_fetch( &c->live, 1, __ATOMIC_ACQ_REL ) == 0) {
+    free(c);
+  }
+}
+
+/**
+Drops a reference to the given node.  When the last reference goes away, the
+node's value is freed and its children are released recursively.
+@param n the node to release
+*/
+static void releaseNode( Node *n )
+{
+  if (__atomic_sub_fetch( &n->refs, 1, __ATOMIC_ACQ_REL ) != 0) {
+    return;
+  }
+  for (int i = 0; i < SYM_COUNT; i++){
+    if ((n->child)[i] != NULL){
+      releaseNode((n->child)[i]);
     }
-    n = &((*n)->child[key[i] - '!']);
   }
+  if (n->val != NULL) {
+    n->val->destroy(n->val);
+  }
+  freeNode(n);
+}
+
+/**
+Makes sure the node at the given location exists and is owned only by the
+caller, so it can be modified.  A missing node is created, and a node shared
+with a snapshot is replaced by a private copy (path copying).
+@param m the map the node belongs to
+@param n location of the node pointer, inside the map or a parent node
+@return the node that can now be modified
+*/
+static Node *ownNode( Map *m, Node **n )
+{
   if (*n == NULL) {
     *n = initializeNode();
-    m->size++;
-  }
-  if ((*n)->val != NULL) {
-    (*n)->val->destroy((*n)->val);
-    (*n)->val = NULL;
+    m->bytes += sizeof( Node );
+  } else if (__atomic_load_n( &(*n)->refs, __ATOMIC_ACQUIRE ) > 1) {
+    Node *old = *n;
+    Node *copy = initializeNode();
+    copy->kids = old->kids;
+    copy->keys = old->keys;
+    copy->dcount = old->dcount;
+    copy->isum = old->isum;
+    copy->dsum = old->dsum;
+    copy->derr = old->derr;
+    copy->slot = old->slot;
+    copy->front = old->front;
+    if (m->front != NULL && copy->front >= 0 && m->front[copy->front].node == old) {
+      m->front[copy->front].node = copy;
+    }
+    if (old->val != NULL) {
+      copy->val = copyValue(old->val);
+    }
+    for (int i = 0; i < SYM_COUNT; i++){
+      if ((old->child)[i] != NULL) {
+        retainNode((old->child)[i]);
+        (copy->child)[i] = (old->child)[i];
+      }
+    }
+    releaseNode(old);
+    *n = copy;
   }
-  (*n)->val = val;
+  return *n;
 }
 
 /**
-Function returns the value associated with the given key
-If the key isn’t in the map, it returns NULL. The returned Value is still considered part of the map representation and is still owned by the map.
-@param key the key
-@return the value associated with the key
+Finds the node for the given key, without modifying the tree
+@param n the root of the tree to search
+@param key the key to look for
+@return the node for the key, or NULL if there's no such node
 */
-Value *mapGet( Map *m, char const *key )
+static Node *findNode( Node *n, char const *key )
 {
-  Node **n = &m->root;
-  for (int i = 0; key[i]; i++){
-    if (key[i] - '!' > SYM_COUNT || key[i] - '!' < 0) {
-      return NULL;
-    }
-    if (*n == NULL) {
+  for (int i = 0; key[i] && n != NULL; i++){
+    int idx = symIndex(key[i]);
+    if (idx < 0) {
       return NULL;
     }
-    n = &((*n)->child[key[i] - '!']);
-  }
-  if (*n == NULL) {
-    return NULL;
+    n = (n->child)[idx];
   }
-  return (*n)->val;
+  return n;
 }
 
 /**
-This function removes the key / value pair for the given key from the map, freeing all the memory for that pair
-@return true if there was a matching key in the map and returns false otherwise.
+Walks down to the node for the given key, taking ownership of every node on the
+path so the key's node can be modified.  Missing nodes are created.
+@param m the map
+@param key the key, which must only contain valid key characters
+@return the node for the key
 */
-bool mapRemove( Map *m, char const *key )
+static Node *ownPath( Map *m, char const *key )
 {
-  Node **n = &m->root;
+  Node *n = ownNode(m, &m->root);
   for (int i = 0; key[i]; i++){
-    if (key[i] - '!' > SYM_COUNT || key[i] - '!' < 0) {
-      return false;
+    Node **c = &(n->child[key[i] - FIRST_SYM]);
+    if (*c == NULL) {
+      n->kids++;
     }
-    if (*n == NULL) {
-      return false;
-    }
-    n = &((*n)->child[key[i] - '!']);
+    n = ownNode(m, c);
   }
-  if (*n == NULL) {
-    return false;
+  return n;
+}
+
+/**
+Returns what a value adds to the numeric totals of the nodes above it
+@param v the value, or NULL
+@return the value's totals, all zero for a string or no value
+*/
+static PrefixSum valueSums( Value const *v )
+{
+  PrefixSum s = { 0, 0, 0, 0 };
+  int i;
+  if (v != NULL && integerValue(v, &i)) {
+    s.integers = i;
+  } else if (v != NULL && doubleValue(v, &s.doubles)) {
+    s.doubleCount = 1;
   }
-  (*n)->val->destroy((*n)->val);
-  (*n)->val = NULL;
-  m->size--;
-  return true;
+  return s;
 }
 
 /**
-Recursively frees all the nodes in the map
-@param the node to free
+Adds a double to a compensated sum.  The rounding error of each addition is
+worked out exactly and kept in a separate total, so small values aren't lost
+when a large one is added and later taken away again.
+@param sum the sum
+@param error rounding error left out of the sum so far
+@param x the value to add
 */
-void freeMapHelper(Node *n)
+static void addCompensated( double *sum, double *error, double x )
 {
-  for (int i = 0; i < SYM_COUNT; i++){
-    if ((n->child)[i] != NULL){
-      freeMapHelper((n->child)[i]);
-      (n->child)[i] = NULL;
-    }
+  double s = *sum + x;
+  double b = s - *sum;
+  if (isfinite(s)) {
+    *error += ( *sum - ( s - b ) ) + ( x - b );
   }
-  if (n->val != NULL) {
-    n->val->destroy(n->val);
-    n->val = NULL;
+  *sum = s;
+}
+
+/**
+Adds totals to a node's totals, or takes them away.  Once a subtree has no
+doubles left, its double sum is set back to exactly zero.
+@param n the node
+@param s the totals to add or take away
+@param sign 1 to add, -1 to take away
+*/
+static void addSums( Node *n, PrefixSum s, int sign )
+{
+  n->isum += sign * s.integers;
+  addCompensated(&n->dsum, &n->derr, sign * s.doubles);
+  n->derr += sign * s.doubleError;
+  n->dcount += sign * s.doubleCount;
+  if (n->dcount == 0) {
+    n->dsum = 0;
+    n->derr = 0;
   }
-  if (n != NULL) {
-    free(n);
+}
+
+/**
+Updates the key counts and numeric totals in every node on a key's path after
+the key's value changes.  The path must be private.
+@param m the map
+@param key the key
+@param keys change in the number of keys: 1, 0 or -1
+@param oldSums totals for the key's old value
+@param newSums totals for the key's new value
+*/
+static void updatePath( Map *m, char const *key, int keys, PrefixSum oldSums, PrefixSum newSums )
+{
+  Node *p = m->root;
+  for (int i = 0; ; i++){
+    p->keys += keys;
+    addSums(p, oldSums, -1);
+    addSums(p, newSums, 1);
+    if (key[i] == '\0') {
+      break;
+    }
+    p = (p->child)[key[i] - FIRST_SYM];
   }
-  n = NULL;
 }
 
 /**
-This function frees all the memory used to store the given map, including the memory used by all the Nodes and the Values inside them.
-@param m the map to free
+Adds every key in a subtree to a Bloom filter.  The hashes are carried down
+the walk one character at a time, so the keys are never built.
+@param b the filter
+@param n root of the subtree, or NULL
+@param h FNV-1a hash of the key for n, before the final mix
+@return number of keys added
 */
-void freeMap( Map *m )
+static long fillBloom( Bloom *b, Node const *n, uint64_t h )
 {
-  if (m->root != NULL) {
-    freeMapHelper(m->root);
+  if (n == NULL) {
+    return 0;
+  }
+  long count = 0;
+  if (n->val != NULL) {
+    bloomAdd(b, bloomMix(h));
+    count++;
   }
-  if (m != NULL) {
-    free(m);
+  for (int i = 0, left = n->kids; left > 0; i++){
+    if ((n->child)[i] != NULL) {
+      count += fillBloom(b, (n->child)[i], bloomStep(h, FIRST_SYM + i));
+      left--;
+    }
   }
-}
\ No newline at end of file
+  return count;
+}
+
+/**
+Body of the thread that rebuilds a Bloom filter from a pinned trie
+@param arg the BloomBuild
+@return NULL
+*/
+static void *runBloomBuild( void *arg )
+{
+  BloomBuild *build = (BloomBuild *) arg;
+  build->filter.keys = fillBloom(&build->filter, build->root, BLOOM_SEED);
+  __atomic_store_n(&build->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/**
+Waits for a Bloom filter rebuild to finish and unpins the trie it read.  The
+new filter, with the keys added meanwhile, replaces the old one unless the
+rebuild is being thrown away.
+@param m the map, which must have a rebuild in progress
+@param install true to start using the new filter
+*/
+static void finishBloomBuild( Map *m, bool install )
+{
+  BloomBuild *build = m->bloomBuild;
+  pthread_join(build->thread, NULL);
+  if (install) {
+    for (int i = 0; i < build->addedCount; i++){
+      bloomAdd(&build->filter, build->added[i]);
+    }
+    build->filter.keys += build->addedCount;
+    build->filter.stale = build->removed;
+    free(m->bloom.blocks);
+    m->bloom = build->filter;
+    m->bloomRebuilds++;
+  } else {
+    free(build->filter.blocks);
+  }
+  if (build->root != NULL) {
+    releaseNode(build->root);
+  }
+  free(build->added);
+  free(build);
+  m->bloomBuild = NULL;
+}
+
+/**
+Keeps the Bloom filter useful.  A finished rebuild is installed, and a new
+one is started once the filter's false positive rate has drifted too high:
+when it holds more keys than it was sized for, or when the keys removed
+since it was built, which it still lets through, pass a quarter of its
+capacity.  The rebuild pins the current trie, so until it's done, changes
+to the map copy the nodes they touch.
+@param m the map
+*/
+static void maintainBloom( Map *m )
+{
+  if (m->bloomBits == 0) {
+    return;
+  }
+  if (m->bloomBuild != NULL) {
+    if (__atomic_load_n(&m->bloomBuild->done, __ATOMIC_ACQUIRE)) {
+      finishBloomBuild(m, true);
+    }
+    return;
+  }
+  Bloom *b = &m->bloom;
+  if (b->keys <= b->capacity && b->stale <= b->capacity / 4) {
+    return;
+  }
+  BloomBuild *build = (BloomBuild *) malloc( sizeof( BloomBuild ) );
+  build->root = m->root;
+  if (build->root != NULL) {
+    retainNode(build->root);
+  }
+  build->filter = makeBloom((long) BLOOM_HEADROOM * m->size, m->bloomBits);
+  build->done = 0;
+  build->addedCap = 64;
+  build->addedCount = 0;
+  build->added = (uint64_t *) malloc( build->addedCap * sizeof( uint64_t ) );
+  build->removed = 0;
+  m->bloomBuild = build;
+  pthread_create(&build->thread, NULL, runBloomBuild, build);
+}
+
+/**
+Adds a key that's new to the map to the Bloom filter, and to the list of keys
+for a rebuild in progress
+@param m the map
+@param key the key
+*/
+static void bloomAdded( Map *m, char const *key )
+{
+  uint64_t h = bloomHash(key);
+  bloomAdd(&m->bloom, h);
+  m->bloom.keys++;
+  BloomBuild *build = m->bloomBuild;
+  if (build != NULL) {
+    if (build->addedCount >= build->addedCap) {
+      build->addedCap *= 2;
+      build->added = (uint64_t *) realloc( build->added, build->addedCap * sizeof( uint64_t ) );
+    }
+    build->added[build->addedCount++] = h;
+  }
+}
+
+/**
+Notes that keys have been removed from the map, so the Bloom filter holds
+that many more stale keys
+@param m the map
+@param count number of keys removed
+*/
+static void bloomRemoved( Map *m, long count )
+{
+  if (m->bloomBits == 0) {
+    return;
+  }
+  m->bloom.stale += count;
+  if (m->bloomBuild != NULL) {
+    m->bloomBuild->removed += count;
+  }
+}
+
+/**
+Checks the Bloom filter before a lookup walks the trie
+@param m the map
+@param key the key being looked up
+@return true if the key definitely isn't in the map
+*/
+static bool bloomRejects( Map *m, char const *key )
+{
+  if (m->bloomBits == 0 || bloomTest(&m->bloom, bloomHash(key))) {
+    return false;
+  }
+  m->bloomRejected++;
+  return true;
+}
+
+/**
+Counts a lookup the Bloom filter let through if the key wasn't in the map
+after all
+@param m the map
+@param found true if the lookup found the key
+*/
+static void bloomChecked( Map *m, bool found )
+{
+  if (m->bloomBits > 0 && !found) {
+    m->bloomFalse++;
+  }
+}
+
+/**
+Turns on a Bloom filter for the map's lookups, replacing any existing one and
+resetting its statistics.  The filter starts out holding the keys already in
+the map.
+@param m the map
+@param bits number of bits per key, which sets the false positive rate
+*/
+void mapEnableBloomFilter( Map *m, int bits )
+{
+  mapDisableBloomFilter(m);
+  m->bloomBits = bits;
+  m->bloom = makeBloom((long) BLOOM_HEADROOM * m->size, bits);
+  m->bloom.keys = fillBloom(&m->bloom, m->root, BLOOM_SEED);
+  m->bloomRejected = 0;
+  m->bloomFalse = 0;
+  m->bloomRebuilds = 0;
+}
+
+/**
+Turns off the Bloom filter, waiting for any rebuild and freeing its memory
+@param m the map
+*/
+void mapDisableBloomFilter( Map *m )
+{
+  if (m->bloomBits == 0) {
+    return;
+  }
+  if (m->bloomBuild != NULL) {
+    finishBloomBuild(m, false);
+  }
+  free(m->bloom.blocks);
+  m->bloom.blocks = NULL;
+  m->bloomBits = 0;
+}
+
+/**
+Reports how well the Bloom filter is working, first installing a rebuild if
+one has finished
+@param m the map
+@param stats returns the filter's statistics
+*/
+void mapBloomFilterStats( Map *m, BloomStats *stats )
+{
+  maintainBloom(m);
+  stats->bytes = m->bloomBits > 0 ? ( m->bloom.mask + 1 ) * sizeof( BloomBlock ) : 0;
+  stats->capacity = m->bloom.capacity;
+  stats->keys = m->bloom.keys;
+  stats->stale = m->bloom.stale;
+  stats->rejected = m->bloomRejected;
+  stats->falsePositives = m->bloomFalse;
+  stats->rebuilds = m->bloomRebuilds;
+  stats->rebuilding = m->bloomBuild != NULL;
+}
+
+/**
+Removes the value for the given key, which must be in the map, and frees any
+nodes on the key's path that are no longer needed
+@param m the map
+@param key the key to remove
+*/
+static void removeKey( Map *m, char const *key )
+{
+  Node *n = ownPath(m, key);
+  PrefixSum oldSums = valueSums(n->val);
+  m->bytes -= valueBytes(n->val);
+  n->val->destroy(n->val);
+  n->val = NULL;
+  m->size--;
+  bloomRemoved(m, 1);
+  int slot = n->slot;
+  n->slot = -1;
+  if (m->front != NULL && n->front >= 0 && m->front[n->front].node == n) {
+    m->front[n->front].node = NULL;
+  }
+  n->front = -1;
+
+  // Find the highest node on the path that only leads to the removed key.
+  // The path is all private now, so the nodes below it can just be freed.
+  Node **cut = &m->root;
+  Node *cutParent = NULL;
+  int cutDepth = 0;
+  n = m->root;
+  for (int i = 0; key[i]; i++){
+    n->keys--;
+    addSums(n, oldSums, -1);
+    if (n->val != NULL || n->kids > 1) {
+      cut = &(n->child[key[i] - FIRST_SYM]);
+      cutParent = n;
+      cutDepth = i + 1;
+    }
+    n = (n->child)[key[i] - FIRST_SYM];
+  }
+  n->keys--;
+  addSums(n, oldSums, -1);
+  if (n->val == NULL && n->kids == 0) {
+    m->bytes -= ( strlen(key) - cutDepth + 1 ) * sizeof( Node );
+    releaseNode(*cut);
+    *cut = NULL;
+    if (cutParent != NULL) {
+      cutParent->kids--;
+    }
+  }
+
+  // Free the key's clock entry last, since the key might be stored there.
+  if (slot >= 0) {
+    ClockEntry *e = &m->clock[slot];
+    m->bytes -= strlen(e->key) + 1;
+    free(e->key);
+    e->key = NULL;
+    m->freeSlots[m->freeCount++] = slot;
+  }
+}
+
+/**
+Evicts keys that haven't been used recently until a size-limited map is back
+within its limit.  This is the CLOCK approximation of least-recently-used:
+the hand sweeps the keys, giving each recently used key a second chance.
+@param m the map
+*/
+static void enforceLimit( Map *m )
+{
+  while (m->limit > 0 && m->bytes > m->limit && m->size > 0) {
+    ClockEntry *e = &m->clock[m->hand];
+    if (e->key != NULL) {
+      if (e->used) {
+        e->used = false;
+      } else {
+        removeKey(m, e->key);
+      }
+    }
+    m->hand = (m->hand + 1) % m->clockCap;
+  }
+}
+
+/**
+Gives the key at the given node an entry in the eviction clock
+@param m the size-limited map
+@param n the key's node
+@param key the key
+*/
+static void addClockEntry( Map *m, Node *n, char const *key )
+{
+  if (m->freeCount == 0) {
+    int oldCap = m->clockCap;
+    m->clockCap *= 2;
+    m->clock = (ClockEntry *) realloc( m->clock, m->clockCap * sizeof( ClockEntry ) );
+    m->freeSlots = (int *) realloc( m->freeSlots, m->clockCap * sizeof( int ) );
+    for (int i = m->clockCap - 1; i >= oldCap; i--){
+      m->clock[i].key = NULL;
+      m->freeSlots[m->freeCount++] = i;
+    }
+  }
+  n->slot = m->freeSlots[--m->freeCount];
+  ClockEntry *e = &m->clock[n->slot];
+  e->key = (char *) malloc( strlen(key) + 1 );
+  strcpy(e->key, key);
+
+  // New keys start out unused, so a burst of one-time keys can't push out
+  // keys that are actually being reused.
+  e->used = false;
+  m->bytes += strlen(key) + 1;
+}
+
+/**
+Adds the given key / value pair to the given map
+If the key is already in the map, it replaces its value with the given value
+The map will take ownership of the given value object (but not the key)
+It can use the value as part of its representation and it’s responsible for freeing it when it’s no longer needed.
+@param m the map
+@param key the key
+@param val the value
+*/
+void mapSet( Map *m, char const *key, Value *val )
+{
+  Node *n = ownPath(m, key);
+  PrefixSum oldSums = valueSums(n->val);
+  PrefixSum newSums = valueSums(val);
+  int added = 0;
+  if (n->val != NULL) {
+    m->bytes -= valueBytes(n->val);
+    n->val->destroy(n->val);
+    if (n->slot >= 0) {
+      m->clock[n->slot].used = true;
+    }
+  } else {
+    m->size++;
+    added = 1;
+    if (m->limit > 0) {
+      addClockEntry(m, n, key);
+    }
+    if (m->bloomBits > 0) {
+      bloomAdded(m, key);
+    }
+  }
+
+  // The path is private now, so the counts can be updated in place.
+  if (added || oldSums.integers != 0 || oldSums.doubleCount != 0 ||
+      newSums.integers != 0 || newSums.doubleCount != 0) {
+    updatePath(m, key, added, oldSums, newSums);
+  }
+  n->val = val;
+  m->bytes += valueBytes(val);
+  enforceLimit(m);
+  maintainBloom(m);
+}
+
+/**
+Looks for a key in the front cache, counting the hit or miss
+@param m the map, which must have a front cache
+@param key the key to look for
+@param h hash of the key
+@return the key's node, or NULL if the cache doesn't have it
+*/
+static Node *frontLookup( Map *m, char const *key, unsigned h )
+{
+  FrontEntry *e = &m->front[h & m->frontMask];
+  if (e->node != NULL && e->hash == h && strcmp(e->key, key) == 0) {
+    m->frontHits++;
+    return e->node;
+  }
+  m->frontMisses++;
+  return NULL;
+}
+
+/**
+Remembers the node found for a key in the front cache, if the key is in the map
+@param m the map, which must have a front cache
+@param key the key
+@param h hash of the key
+@param n the key's node, or NULL
+*/
+static void frontInsert( Map *m, char const *key, unsigned h, Node *n )
+{
+  if (n == NULL || n->val == NULL) {
+    return;
+  }
+
+  // Take over the entry for this key's node.
+  FrontEntry *e = &m->front[h & m->frontMask];
+  if (e->node != NULL) {
+    e->node->front = -1;
+  }
+  int len = strlen(key);
+  if (len + 1 > e->keyCap) {
+    e->keyCap = len + 1;
+    e->key = (char *) realloc( e->key, e->keyCap );
+  }
+  strcpy(e->key, key);
+  e->hash = h;
+  e->node = n;
+  n->front = e - m->front;
+}
+
+/**
+Finishes a lookup once the key's node is known, marking the key as used
+@param m the map
+@param n the key's node, or NULL
+@return the key's value, or NULL if it's not in the map
+*/
+static Value *foundNode( Map *m, Node *n )
+{
+  if (n == NULL) {
+    return NULL;
+  }
+  if (n->slot >= 0) {
+    m->clock[n->slot].used = true;
+  }
+  return n->val;
+}
+
+/**
+Function returns the value associated with the given key
+If the key isn’t in the map, it returns NULL. The returned Value is still considered part of the map representation and is still owned by the map.
+@param key the key
+@return the value associated with the key
+*/
+Value *mapGet( Map *m, char const *key )
+{
+  if (bloomRejects(m, key)) {
+    return NULL;
+  }
+  Node *n = NULL;
+  if (m->front != NULL) {
+    unsigned h = mapHashKey(key);
+    n = frontLookup(m, key, h);
+    if (n == NULL) {
+      n = findNode(m->root, key);
+      frontInsert(m, key, h, n);
+    }
+  } else {
+    n = findNode(m->root, key);
+  }
+  Value *val = foundNode(m, n);
+  bloomChecked(m, val != NULL);
+  return val;
+}
+
+/**
+Prefetches the part of a node that the next step of a walk will read: the
+child pointer for the next key character, or the value at the end of the key
+@param n the node
+@param c the next key character, or the null terminator
+*/
+static void prefetchStep( Node const *n, char c )
+{
+  int idx = symIndex(c);
+  if (idx >= 0) {
+    __builtin_prefetch(&(n->child)[idx]);
+  } else {
+    __builtin_prefetch(&n->val);
+  }
+}
+
+/**
+Looks up several keys at once, getting the same values as calling mapGet() on
+each one.  The walks are interleaved and each step prefetches what the next
+step reads, so independent cache misses overlap.
+@param m the map
+@param keys the keys to look for
+@param n number of keys
+@param out returns the value for each key, or NULL if it's not in the map
+*/
+void mapGetBatch( Map *m, char const *keys[], int n, Value *out[] )
+{
+  // Each lane walks one key, one level per round, and takes the next key
+  // that needs a walk as soon as it finishes.
+  int lane[BATCH_LANES];
+  Node *node[BATCH_LANES];
+  int pos[BATCH_LANES];
+  unsigned hash[BATCH_LANES];
+  int active = 0;
+  int next = 0;
+
+  for (;;) {
+    // Fill empty lanes, answering what we can from the front cache.
+    while (active < BATCH_LANES && next < n) {
+      int k = next++;
+      if (bloomRejects(m, keys[k])) {
+        out[k] = NULL;
+        continue;
+      }
+      unsigned h = 0;
+      if (m->front != NULL) {
+        h = mapHashKey(keys[k]);
+        Node *hit = frontLookup(m, keys[k], h);
+        if (hit != NULL) {
+          out[k] = foundNode(m, hit);
+          continue;
+        }
+      }
+      if (m->root == NULL) {
+        // An empty map has nothing to walk, just as in mapGet().
+        if (m->front != NULL) {
+          frontInsert(m, keys[k], h, NULL);
+        }
+        out[k] = NULL;
+        bloomChecked(m, false);
+        continue;
+      }
+      lane[active] = k;
+      node[active] = m->root;
+      pos[active] = 0;
+      hash[active] = h;
+      prefetchStep(m->root, keys[k][0]);
+      active++;
+    }
+    if (active == 0) {
+      break;
+    }
+
+    // Move every lane down one level, prefetching for the level after.
+    for (int i = 0; i < active; ) {
+      char const *key = keys[lane[i]];
+      char c = key[pos[i]];
+      Node *cur = node[i];
+      bool done = true;
+      if (c == '\0') {
+        // cur is the key's node.
+      } else if (symIndex(c) < 0) {
+        cur = NULL;
+      } else {
+        cur = (cur->child)[symIndex(c)];
+        pos[i]++;
+        if (cur != NULL) {
+          prefetchStep(cur, key[pos[i]]);
+          node[i] = cur;
+          done = false;
+        }
+      }
+      if (done) {
+        if (m->front != NULL) {
+          frontInsert(m, key, hash[i], cur);
+        }
+        out[lane[i]] = foundNode(m, cur);
+        bloomChecked(m, out[lane[i]] != NULL);
+
+        // Move the last lane into this one's place.
+        active--;
+        lane[i] = lane[active];
+        node[i] = node[active];
+        pos[i] = pos[active];
+        hash[i] = hash[active];
+      } else {
+        i++;
+      }
+    }
+  }
+}
+
+/**
+Adds the given value to the value stored under the given key, copying the key's
+value first if it's shared with a snapshot
+@param m the map
+@param key the key whose value is modified
+@param x the value to add, still owned by the caller
+@return true if the key is in the map and its value could be added to
+*/
+bool mapPlus( Map *m, char const *key, Value const *x )
+{
+  if (bloomRejects(m, key)) {
+    return false;
+  }
+  Node *n = findNode(m->root, key);
+  bloomChecked(m, n != NULL && n->val != NULL);
+  if (n == NULL || n->val == NULL) {
+    return false;
+  }
+  n = ownPath(m, key);
+  PrefixSum oldSums = valueSums(n->val);
+  m->bytes -= valueBytes(n->val);
+  bool added = n->val->plus(n->val, x);
+  m->bytes += valueBytes(n->val);
+  PrefixSum newSums = valueSums(n->val);
+  if (oldSums.integers != newSums.integers || oldSums.doubles != newSums.doubles) {
+    updatePath(m, key, 0, oldSums, newSums);
+  }
+  if (n->slot >= 0) {
+    m->clock[n->slot].used = true;
+  }
+  enforceLimit(m);
+  return added;
+}
+
+/**
+This function removes the key / value pair for the given key from the map, freeing all the memory for that pair
+@return true if there was a matching key in the map and returns false otherwise.
+*/
+bool mapRemove( Map *m, char const *key )
+{
+  if (bloomRejects(m, key)) {
+    return false;
+  }
+  Node *n = findNode(m->root, key);
+  bloomChecked(m, n != NULL && n->val != NULL);
+  if (n == NULL || n->val == NULL) {
+    return false;
+  }
+  removeKey(m, key);
+  maintainBloom(m);
+  return true;
+}
+
+/**
+Counts the keys that start with the given prefix, from the count kept in the
+prefix's node
+@param m the map
+@param prefix the prefix; the empty string counts every key
+@return number of keys with the prefix
+*/
+int mapPrefixCount( Map *m, char const *prefix )
+{
+  Node *n = findNode(m->root, prefix);
+  return n == NULL ? 0 : n->keys;
+}
+
+/**
+Adds up the numeric values of the keys that start with the given prefix,
+from the totals kept in the prefix's node
+@param m the map
+@param prefix the prefix; the empty string covers every key
+@param sum returns the totals
+*/
+void mapPrefixSum( Map *m, char const *prefix, PrefixSum *sum )
+{
+  Node *n = findNode(m->root, prefix);
+  sum->integers = n == NULL ? 0 : n->isum;
+  sum->doubles = n == NULL ? 0 : n->dsum;
+  sum->doubleError = n == NULL ? 0 : n->derr;
+  sum->doubleCount = n == NULL ? 0 : n->dcount;
+}
+
+/**
+Adds one set of prefix totals into another
+@param sum the totals to add to
+@param part the totals to add from
+*/
+void addPrefixSum( PrefixSum *sum, PrefixSum const *part )
+{
+  sum->integers += part->integers;
+  addCompensated(&sum->doubles, &sum->doubleError, part->doubles);
+  sum->doubleError += part->doubleError;
+  sum->doubleCount += part->doubleCount;
+}
+
+/**
+Adds up the bytes the map is charged for the nodes and values in a subtree,
+and frees the eviction clock entries of its keys if the map has a limit
+@param m the map the subtree was removed from
+@param n root of the subtree
+@return the bytes for the subtree
+*/
+static size_t subtreeBytes( Map *m, Node *n )
+{
+  size_t bytes = sizeof( Node );
+  if (n->val != NULL) {
+    bytes += valueBytes(n->val);
+  }
+  if (m->limit > 0 && n->slot >= 0 && m->clock[n->slot].key != NULL) {
+    ClockEntry *e = &m->clock[n->slot];
+    bytes += strlen(e->key) + 1;
+    free(e->key);
+    e->key = NULL;
+    m->freeSlots[m->freeCount++] = n->slot;
+  }
+  for (int i = 0; i < SYM_COUNT && n->kids > 0; i++){
+    if ((n->child)[i] != NULL) {
+      bytes += subtreeBytes(m, (n->child)[i]);
+    }
+  }
+  return bytes;
+}
+
+/**
+Body of a map's reaper thread, which frees removed subtrees until it's told
+to stop and its queue is empty
+@param arg the map
+@return NULL
+*/
+static void *runReaper( void *arg )
+{
+  Map *m = (Map *) arg;
+  pthread_mutex_lock(&m->reapLock);
+  for (;;) {
+    while (m->reapQueue == NULL && !m->reapStop) {
+      pthread_cond_wait(&m->reapReady, &m->reapLock);
+    }
+    Reap *r = m->reapQueue;
+    if (r == NULL) {
+      break;
+    }
+    m->reapQueue = r->next;
+    pthread_mutex_unlock(&m->reapLock);
+
+    // Background freeing is only used without a limit, so there are no clock
+    // entries for subtreeBytes() to touch.
+    size_t bytes = subtreeBytes(m, r->root);
+    releaseNode(r->root);
+    free(r);
+    __atomic_add_fetch(&m->reaped, bytes, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&m->reapLock);
+  }
+  pthread_mutex_unlock(&m->reapLock);
+  return NULL;
+}
+
+/**
+Chooses whether mapRemovePrefix() frees removed subtrees on a background
+thread.  Maps with a memory limit always free them right away, so the
+limit stays accurate.
+@param m the map
+@param on true to free in the background
+*/
+void mapFreeInBackground( Map *m, bool on )
+{
+  m->background = on;
+}
+
+/**
+Removes every key that starts with the given prefix.  The subtree under the
+prefix is detached after a walk down the prefix, and the counts of keys
+stored in the nodes on the way fix the map's size without visiting the
+subtree.  The subtree is then freed, either right away or by the map's
+reaper thread.
+@param m the map
+@param prefix the prefix; the empty string removes everything
+@return number of keys removed
+*/
+int mapRemovePrefix( Map *m, char const *prefix )
+{
+  Node *target = findNode(m->root, prefix);
+  if (target == NULL || target->keys == 0) {
+    return 0;
+  }
+  int count = target->keys;
+  PrefixSum sums;
+  mapPrefixSum(m, prefix, &sums);
+
+  // Take ownership of the path down to the prefix's parent, and find the
+  // highest node that only leads to the prefix, like removeKey() does.
+  int len = strlen(prefix);
+  char parentKey[len + 1];
+  memcpy(parentKey, prefix, len);
+  parentKey[len > 0 ? len - 1 : 0] = '\0';
+  Node **cut = &m->root;
+  Node *cutParent = NULL;
+  if (len > 0) {
+    ownPath(m, parentKey);
+    Node *n = m->root;
+    for (int i = 0; i < len; i++){
+      n->keys -= count;
+      addSums(n, sums, -1);
+      if (n->val != NULL || n->kids > 1) {
+        cut = &(n->child[prefix[i] - FIRST_SYM]);
+        cutParent = n;
+      }
+      n = (n->child)[prefix[i] - FIRST_SYM];
+    }
+  }
+  Node *detached = *cut;
+  *cut = NULL;
+  if (cutParent != NULL) {
+    cutParent->kids--;
+  }
+  m->size -= count;
+
+  // Forget any front cache entries for keys in the subtree.  This has to
+  // check every entry: nodes shared with a snapshot aren't freed, and the
+  // reaper can't touch the cache, so freeNode() can't be relied on to do it.
+  if (m->front != NULL) {
+    for (unsigned i = 0; i <= m->frontMask; i++){
+      FrontEntry *e = &m->front[i];
+      if (e->node != NULL && strncmp(e->key, prefix, len) == 0) {
+        e->node = NULL;
+      }
+    }
+  }
+
+  if (m->background && m->limit == 0) {
+    Reap *r = (Reap *) malloc( sizeof( Reap ) );
+    r->root = detached;
+    pthread_mutex_lock(&m->reapLock);
+    if (!m->reaping) {
+      pthread_create(&m->reaper, NULL, runReaper, m);
+      m->reaping = true;
+    }
+    r->next = m->reapQueue;
+    m->reapQueue = r;
+    pthread_cond_signal(&m->reapReady);
+    pthread_mutex_unlock(&m->reapLock);
+  } else {
+    m->bytes -= subtreeBytes(m, detached);
+    releaseNode(detached);
+  }
+  bloomRemoved(m, count);
+  maintainBloom(m);
+  return count;
+}
+
+/**
+Moves a node to the next free place in the layout's current chunk, starting a
+new chunk when that one is full.  The node must only be referenced from the
+given location.
+@param m the map the node belongs to
+@param l the layout pass
+@param n location of the node pointer, inside the map or a parent node
+@return the node in its new place
+*/
+static Node *packNode( Map *m, Layout *l, Node **n )
+{
+  if (l->chunk == NULL || l->used == LAYOUT_NODES) {
+    if (posix_memalign((void **) &l->chunk, LAYOUT_CHUNK, LAYOUT_CHUNK) != 0) {
+      abort();
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(l->chunk, LAYOUT_CHUNK, MADV_HUGEPAGE);
+#endif
+    ((Chunk *) l->chunk)->live = 0;
+    l->used = 0;
+  }
+  Node *old = *n;
+  Node *copy = (Node *) ( l->chunk + 64 + l->used++ * LAYOUT_STRIDE );
+  memcpy(copy, old, sizeof( Node ));
+  copy->packed = true;
+  __atomic_add_fetch( &((Chunk *) l->chunk)->live, 1, __ATOMIC_RELAXED );
+  if (m->front != NULL && copy->front >= 0 && m->front[copy->front].node == old) {
+    m->front[copy->front].node = copy;
+  }
+  freeNode(old);
+  *n = copy;
+  l->moved++;
+  return copy;
+}
+
+/**
+Returns true if the node at the given location can be moved: it exists, and
+nothing else refers to it
+@param n location of the node pointer
+@return true if the node can be moved
+*/
+static bool movable( Node **n )
+{
+  return *n != NULL && __atomic_load_n( &(*n)->refs, __ATOMIC_ACQUIRE ) == 1;
+}
+
+/**
+Packs a subtree depth-first, each node followed by its children's subtrees
+in key order
+@param m the map
+@param l the layout pass
+@param n location of the subtree's root pointer, which must be movable
+*/
+static void packSubtree( Map *m, Layout *l, Node **n )
+{
+  Node *p = packNode(m, l, n);
+  for (int i = 0, left = p->kids; left > 0; i++){
+    if ((p->child)[i] != NULL) {
+      left--;
+      if (movable(&(p->child)[i])) {
+        packSubtree(m, l, &(p->child)[i]);
+      }
+    }
+  }
+}
+
+/**
+Moves the map's nodes into chunks, the first chunk's worth breadth-first from
+the root and the rest depth-first
+@param m the map
+@return number of nodes moved
+*/
+int mapOptimizeLayout( Map *m )
+{
+  // A Bloom filter rebuild pins the root, so nothing could move until it's done.
+  if (m->bloomBuild != NULL) {
+    finishBloomBuild(m, true);
+  }
+  Layout l = { NULL, 0, 0 };
+  int head = 0, tail = 0, cap = 64;
+  Node ***queue = (Node ***) malloc( cap * sizeof( Node ** ) );
+  if (movable(&m->root)) {
+    queue[tail++] = &m->root;
+  }
+
+  // The levels near the root are on every lookup's path, so they go first,
+  // together.
+  while (head < tail && l.moved < LAYOUT_NODES) {
+    Node *p = packNode(m, &l, queue[head++]);
+    for (int i = 0, left = p->kids; left > 0; i++){
+      if ((p->child)[i] != NULL) {
+        left--;
+        if (movable(&(p->child)[i])) {
+          if (tail >= cap) {
+            cap *= 2;
+            queue = (Node ***) realloc( queue, cap * sizeof( Node ** ) );
+          }
+          queue[tail++] = &(p->child)[i];
+        }
+      }
+    }
+  }
+
+  // Below them, each subtree is kept together.
+  while (head < tail) {
+    packSubtree(m, &l, queue[head++]);
+  }
+  free(queue);
+  return l.moved;
+}
+
+/**
+This function frees all the memory used to store the given map, including the memory used by all the Nodes and the Values inside them.
+Nodes still shared with a snapshot stay around until the snapshot is freed.
+@param m the map to free
+*/
+void freeMap( Map *m )
+{
+  if (m->reaping) {
+    pthread_mutex_lock(&m->reapLock);
+    m->reapStop = true;
+    pthread_cond_signal(&m->reapReady);
+    pthread_mutex_unlock(&m->reapLock);
+    pthread_join(m->reaper, NULL);
+  }
+  pthread_mutex_destroy(&m->reapLock);
+  pthread_cond_destroy(&m->reapReady);
+  mapDisableFrontCache(m);
+  mapDisableBloomFilter(m);
+  if (m->root != NULL) {
+    releaseNode(m->root);
+  }
+  for (int i = 0; i < m->clockCap; i++){
+    free(m->clock[i].key);
+  }
+  free(m->clock);
+  free(m->freeSlots);
+  free(m);
+}
+
+/**
+Takes a read-only snapshot of the map in constant time.  The snapshot shares all
+of its nodes with the map, and the map copies nodes before changing them.
+@param m the map
+@return the new snapshot
+*/
+Snapshot *mapSnapshot( Map *m )
+{
+  Snapshot *s = (Snapshot *) malloc( sizeof( Snapshot ) );
+  s->root = m->root;
+  s->size = m->size;
+  if (s->root != NULL) {
+    retainNode(s->root);
+  }
+  return s;
+}
+
+/**
+Returns the number of key / value pairs in the map when the snapshot was taken
+@param s the snapshot
+@return the size of the snapshot
+*/
+int snapshotSize( Snapshot *s )
+{
+  return s->size;
+}
+
+/**
+Returns the value the given key had when the snapshot was taken
+@param s the snapshot
+@param key the key
+@return the value for the key, or NULL if the key wasn't in the map
+*/
+Value const *snapshotGet( Snapshot *s, char const *key )
+{
+  Node *n = findNode(s->root, key);
+  if (n == NULL) {
+    return NULL;
+  }
+  return n->val;
+}
+
+/**
+Frees a snapshot, along with any nodes the map isn't using anymore
+@param s the snapshot to free
+*/
+void freeSnapshot( Snapshot *s )
+{
+  if (s->root != NULL) {
+    releaseNode(s->root);
+  }
+  free(s);
+}
+
+/**
+Visits the keys in a subtree in order, building each key in a buffer that
+grows as needed
+@param n root of the subtree
+@param key buffer holding the key for n, updated
+@param cap capacity of the key buffer, updated
+@param len length of the key for n
+@param visit function called for each key
+@param arg passed along to visit
+*/
+static void visitSubtree( Node *n, char **key, int *cap, int len,
+                          MapVisitor visit, void *arg )
+{
+  if (n->val != NULL) {
+    (*key)[len] = '\0';
+    visit(*key, n->val, arg);
+  }
+  if (n->kids == 0) {
+    return;
+  }
+  if (len + 2 > *cap) {
+    *cap *= 2;
+    *key = (char *) realloc( *key, *cap );
+  }
+  for (int i = 0; i < SYM_COUNT; i++){
+    if ((n->child)[i] != NULL) {
+      (*key)[len] = FIRST_SYM + i;
+      visitSubtree((n->child)[i], key, cap, len + 1, visit, arg);
+    }
+  }
+}
+
+/**
+Calls the given function for every key / value pair in the map, in order of
+the keys
+@param m the map
+@param visit function called with each key, its value and arg
+@param arg passed along to visit
+*/
+void mapForEach( Map *m, MapVisitor visit, void *arg )
+{
+  if (m->root == NULL) {
+    return;
+  }
+  int cap = 64;
+  char *key = (char *) malloc( cap );
+  visitSubtree(m->root, &key, &cap, 0, visit, arg);
+  free(key);
+}
@@ -13,15 +13,32 @@ Contains all of the map related functions
 /** Incomplete type for the Map representation. */
 typedef struct MapStruct Map;
 
+/** Incomplete type for a read-only snapshot of a map. */
+typedef struct SnapshotStruct Snapshot;
+
 /** Make an empty map.
     @return pointer to a new map representation.
 */
 Map *makeMap();
 
+/** Make an empty map that acts as a cache with a memory budget.  The
+    bytes used by its nodes, values and keys are tracked, and whenever
+    the total goes over the limit, keys that haven't been used recently
+    are evicted.  Recency is updated by mapGet(), mapSet() and mapPlus().
+    @param bytes Most memory the map may use.
+    @return pointer to a new map representation.
+*/
+Map *makeMapWithLimit( size_t bytes );
+
 /** Return the size of the given map.
     @param m Pointer to the map.
     @return Number of key/value pairs in the map. */
 int mapSize( Map *m );
+
+/** Return the memory used by the given map.
+    @param m Pointer to the map.
+    @return Bytes used by the map's nodes, values and keys. */
+size_t mapBytes( Map *m );
   
 /** Add a new key / value pair to the map, or replace the value
     associeted with the given key.  The map will take ownership of the
@@ -32,15 +49,207 @@ int mapSize( Map *m );
 */
 void mapSet( Map *m, char const *key, Value *val );
 
+/** Remove every key that starts with the given prefix.  Detaching the
+    keys takes time that depends on the length of the prefix rather than
+    the number of keys removed, but a map with a front cache also checks
+    every cache entry, so the call is linear in the size of the cache.
+    The removed subtree is freed right away, or on a background thread if
+    mapFreeInBackground() turned that on.
+    @param m Map to remove keys from.
+    @param prefix Prefix of the keys to remove.  The empty string removes
+    every key.
+    @return Number of keys removed.
+*/
+int mapRemovePrefix( Map *m, char const *prefix );
+
+/** Return the number of keys that start with the given prefix, in time
+    that depends on the length of the prefix rather than the number of
+    keys, using the key counts kept in the trie's nodes.
+    @param m Map to query.
+    @param prefix Prefix of the keys to count.  The empty string counts
+    every key.
+    @return Number of keys with the prefix.
+*/
+int mapPrefixCount( Map *m, char const *prefix );
+
+/** Totals of the numeric values under a prefix, from mapPrefixSum(). */
+typedef struct {
+  /** Sum of the integer values. */
+  long integers;
+
+  /** Sum of the double values. */
+  double doubles;
+
+  /** Rounding error left out of doubles; the sum of the double values is
+      doubles + doubleError. */
+  double doubleError;
+
+  /** Number of double values. */
+  int doubleCount;
+} PrefixSum;
+
+/** Add up the integer and double values of the keys that start with the
+    given prefix, in time that depends on the length of the prefix.  Each
+    node keeps running totals for its subtree, updated by mapSet(),
+    mapPlus() and the removal functions.  String values aren't counted.
+    @param m Map to query.
+    @param prefix Prefix of the keys to add up.  The empty string covers
+    every key.
+    @param sum Returns the totals.
+*/
+void mapPrefixSum( Map *m, char const *prefix, PrefixSum *sum );
+
+/** Add one set of prefix totals into another, such as the totals for the
+    same prefix in different maps.  The doubles are added with the same
+    compensation the maps use, so the result doesn't depend on how the
+    values were split up.
+    @param sum Totals to add to.
+    @param part Totals to add from.
+*/
+void addPrefixSum( PrefixSum *sum, PrefixSum const *part );
+
+/** Function called by mapForEach() for each key / value pair.  The key
+    is only valid during the call, and the value is still owned by the
+    map. */
+typedef void (*MapVisitor)( char const *key, Value const *val, void *arg );
+
+/** Call a function for every key / value pair in the map, in order of
+    the keys.  The function shouldn't change the map.
+    @param m Map to go through.
+    @param visit Function to call for each pair.
+    @param arg Passed to each call of visit.
+*/
+void mapForEach( Map *m, MapVisitor visit, void *arg );
+
+/** Move the map's nodes into large contiguous chunks, in an order that
+    keeps lookups on few pages: the top of the trie breadth-first, so the
+    levels every lookup passes through share the first chunk, then each
+    remaining subtree depth-first, so the nodes along a key's path sit
+    next to each other.  The chunks are the size of a huge page, and the
+    system is asked to back them with huge pages.  Meant to be run after
+    loading many keys.  Keys added later get nodes of their own, and
+    running this again packs them in too.  Nodes shared with a snapshot
+    are left where they are.
+    @param m Map to lay out.
+    @return Number of nodes moved.
+*/
+int mapOptimizeLayout( Map *m );
+
+/** Choose whether mapRemovePrefix() frees removed keys on a background
+    thread, so the call returns as soon as they're detached.  mapBytes()
+    still counts them until they've been freed.  Maps with a memory
+    limit always free them right away.
+    @param m Map to change.
+    @param on True to free removed keys in the background.
+*/
+void mapFreeInBackground( Map *m, bool on );
+
+/** Turn on a small direct-mapped cache in front of mapGet(), mapping
+    a hash of each recently used key straight to the key's node so
+    popular keys don't need a walk from the root.  The cache is kept up
+    to date as keys are replaced and removed.
+    @param m Map to add a front cache to.
+    @param entries Number of cache entries, rounded up to a power of two.
+*/
+void mapEnableFrontCache( Map *m, int entries );
+
+/** Turn off the front cache, if the map has one.
+    @param m Map to remove the front cache from.
+*/
+void mapDisableFrontCache( Map *m );
+
+/** Report how many mapGet() calls the front cache has answered.
+    @param m Map with a front cache.
+    @param hits Returns the number of lookups answered from the cache.
+    @param misses Returns the number of lookups that walked the trie.
+*/
+void mapFrontCacheStats( Map *m, long *hits, long *misses );
+
+/** How the Bloom filter is doing, as reported by mapBloomFilterStats(). */
+typedef struct {
+  /** Bytes used by the filter. */
+  size_t bytes;
+
+  /** Number of keys the filter was sized for. */
+  long capacity;
+
+  /** Number of keys in the filter. */
+  long keys;
+
+  /** Number of keys in the filter that have since been removed. */
+  long stale;
+
+  /** Number of lookups the filter answered without walking the trie. */
+  long rejected;
+
+  /** Number of lookups the filter let through for keys that weren't in
+      the map. */
+  long falsePositives;
+
+  /** Number of times the filter has been rebuilt. */
+  long rebuilds;
+
+  /** True if a rebuild is running. */
+  bool rebuilding;
+} BloomStats;
+
+/** Turn on a blocked Bloom filter in front of mapGet(), mapGetBatch(),
+    mapPlus() and mapRemove(), so most lookups for keys that aren't in
+    the map are answered from one cache line instead of a walk down the
+    trie.  New keys are added by mapSet().  Removed keys stay in the
+    filter, so once removals or growth push its false positive rate up,
+    it's rebuilt from a pinned copy of the trie on a background thread.
+    @param m Map to add a Bloom filter to.
+    @param bits Bits of filter per key, which sets the false positive
+    rate: 10 gives about 1%, 16 about 0.1%.
+*/
+void mapEnableBloomFilter( Map *m, int bits );
+
+/** Turn off the Bloom filter, if the map has one.
+    @param m Map to remove the Bloom filter from.
+*/
+void mapDisableBloomFilter( Map *m );
+
+/** Report how the Bloom filter is doing.
+    @param m Map with a Bloom filter.
+    @param stats Returns the filter's size and counts.
+*/
+void mapBloomFilterStats( Map *m, BloomStats *stats );
+
 /** Return the value associated with the given key. The returned Value
     is still owned by the map.  The caller can use it but shouldn't free it.
     @param m Map to query.
     @param key Key to look for in the map.
     @return Value associated with the given key, or NULL if the key
-    isn't in the map.
+    isn't in the map.  Changes to the value should be made with mapPlus(),
+    so snapshots sharing the value aren't affected.
 */
 Value *mapGet( Map *m, char const *key );
 
+/** Look up several keys at once, getting the same values as calling
+    mapGet() on each one.  The walks for different keys are interleaved
+    and each step prefetches the part of the node the next step reads,
+    so the cache misses of independent lookups overlap instead of being
+    paid one after another.  This helps most on maps much larger than
+    the processor's caches.
+    @param m Map to query.
+    @param keys Keys to look for.
+    @param n Number of keys.
+    @param out Returns the value for each key, or NULL for keys that
+    aren't in the map.  Values are still owned by the map.
+*/
+void mapGetBatch( Map *m, char const *keys[], int n, Value *out[] );
+
+/** Add the given value to the value associated with the given key,
+    like the value's plus method.  The value x is still owned by the caller.
+    @param m Map containing the value to modify.
+    @param key Key whose value should be added to.
+    @param x Value to add to the key's value.
+    @return true if the key was in the map and its value could be
+    added to x.
+*/
+bool mapPlus( Map *m, char const *key, Value const *x );
+
 /** Remove a key / value pair from the given map.
     @param m Map to remove a key from
     @param key Key to look for and remove in the map.
@@ -49,10 +258,47 @@ Value *mapGet( Map *m, char const *key );
 */
 bool mapRemove( Map *m, char const *key );
 
+/** Hash a key with 32-bit FNV-1a, the hash the front cache uses.  Also
+    good for splitting keys across several maps.
+    @param key The key.
+    @return Hash of the key.
+*/
+unsigned mapHashKey( char const *key );
+
 /** Free all the memory used to store a map, including all the
     memory in its key/value pairs.
     @param m The map to free.
 */
 void freeMap( Map *m );
+
+/** Take a read-only snapshot of the current contents of the map in
+    constant time.  The snapshot shares its nodes and values with the
+    map; later changes to the map copy the parts they modify, so the
+    snapshot keeps seeing a consistent view and readers of the snapshot
+    never have to wait for the map.  The snapshot can outlive the map.
+    @param m Map to take a snapshot of.
+    @return new snapshot, to be freed with freeSnapshot().
+*/
+Snapshot *mapSnapshot( Map *m );
+
+/** Return the size of the map at the time the snapshot was taken.
+    @param s Pointer to the snapshot.
+    @return Number of key/value pairs in the snapshot. */
+int snapshotSize( Snapshot *s );
+
+/** Return the value associated with the given key in a snapshot.
+    The value is still owned by the snapshot.
+    @param s Snapshot to query.
+    @param key Key to look for in the snapshot.
+    @return Value associated with the given key, or NULL if the key
+    wasn't in the map when the snapshot was taken.
+*/
+Value const *snapshotGet( Snapshot *s, char const *key );
+
+/** Free a snapshot, along with any of its nodes and values that are no
+    longer used by the map or by other snapshots.
+    @param s The snapshot to free.
+*/
+void freeSnapshot( Snapshot *s );
   
 #endif
@@ -8,6 +8,73 @@
 #include "value.h"
 #include "map.h"
 
+// Room for the test keys: a short prefix and two ints of any size.
+#define KEY_BUFFER 32
+
+// Keys seen by countKey(), for checking mapForEach().
+typedef struct {
+  int count;
+  int sum;
+  char last[ 100 ];
+} Visited;
+
+// Visitor for mapForEach() that checks the keys come in order.
+static void countKey( char const *key, Value const *val, void *arg )
+{
+  Visited *v = (Visited *) arg;
+  if ( v->count > 0 )
+    assert( strcmp( v->last, key ) < 0 );
+  strcpy( v->last, key );
+  char *s = val->toString( val );
+  v->sum += atoi( s );
+  free( s );
+  v->count++;
+}
+
+// Totals for the keys under a prefix, worked out by going through the map.
+typedef struct {
+  char const *prefix;
+  int count;
+  long integers;
+  double doubles;
+} Expected;
+
+// Visitor for mapForEach() that adds up the keys under a prefix.
+static void addUp( char const *key, Value const *val, void *arg )
+{
+  Expected *e = (Expected *) arg;
+  if ( strncmp( key, e->prefix, strlen( e->prefix ) ) != 0 )
+    return;
+  e->count++;
+  int i;
+  double d;
+  if ( integerValue( val, &i ) )
+    e->integers += i;
+  else if ( doubleValue( val, &d ) )
+    e->doubles += d;
+}
+
+// Return the sum of the double values under a prefix, as the map keeps it.
+static double doubleSum( Map *m, char const *prefix )
+{
+  PrefixSum sum;
+  mapPrefixSum( m, prefix, &sum );
+  return sum.doubles + sum.doubleError;
+}
+
+// Check the counts and totals the map keeps for a prefix against the keys.
+static void checkPrefix( Map *m, char const *prefix )
+{
+  Expected e = { prefix, 0, 0, 0 };
+  mapForEach( m, addUp, &e );
+  assert( mapPrefixCount( m, prefix ) == e.count );
+  PrefixSum sum;
+  mapPrefixSum( m, prefix, &sum );
+  assert( sum.integers == e.integers );
+  double d = doubleSum( m, prefix );
+  assert( d - e.doubles < 1e-6 && e.doubles - d < 1e-6 );
+}
+
 int main()
 {
   // make an empty map.
@@ -76,7 +143,360 @@ int main()
   // Try to remove a value that's not in the map.
   assert( mapRemove( m, "wxyz" ) == false );
 
-  // Free memory for the map.
+  // Take a snapshot, then change the map underneath it.
+  Snapshot *snap = mapSnapshot( m );
+  assert( snapshotSize( snap ) == 2 );
+  mapSet( m, "A", parseInteger( "5" ) );
+  Value *ten = parseInteger( "10" );
+  assert( mapPlus( m, "challenges", ten ) );
+  ten->destroy( ten );
+  assert( mapRemove( m, "A" ) );
+  mapSet( m, "new", parseInteger( "1" ) );
+  assert( mapSize( m ) == 2 );
+
+  // The snapshot should still see the old contents.
+  assert( snapshotSize( snap ) == 2 );
+  Value const *sv = snapshotGet( snap, "A" );
+  assert( sv != NULL );
+  s = sv->toString( sv );
+  assert( strcmp( s, "76" ) == 0 );
+  free( s );
+
+  sv = snapshotGet( snap, "challenges" );
+  s = sv->toString( sv );
+  assert( strcmp( s, "-1" ) == 0 );
+  free( s );
+  assert( snapshotGet( snap, "new" ) == NULL );
+
+  // And the map should see the new ones.
+  v = mapGet( m, "challenges" );
+  s = v->toString( v );
+  assert( strcmp( s, "9" ) == 0 );
+  free( s );
+
+  // Free memory for the map.  The snapshot can outlive it.
+  freeMap( m );
+  assert( snapshotGet( snap, "challenges" ) != NULL );
+  freeSnapshot( snap );
+
+  // Try a map with a front cache for lookups.
+  m = makeMap();
+  mapEnableFrontCache( m, 4 );
+  mapSet( m, "hot", parseInteger( "1" ) );
+  mapSet( m, "hotter", parseInteger( "2" ) );
+  assert( mapGet( m, "hot" ) != NULL );
+  v = mapGet( m, "hot" );
+  s = v->toString( v );
+  assert( strcmp( s, "1" ) == 0 );
+  free( s );
+
+  // Replacing the value should show up through the cache.
+  mapSet( m, "hot", parseInteger( "3" ) );
+  v = mapGet( m, "hot" );
+  s = v->toString( v );
+  assert( strcmp( s, "3" ) == 0 );
+  free( s );
+
+  // So should changes made while a snapshot shares the nodes.
+  snap = mapSnapshot( m );
+  mapSet( m, "hot", parseInteger( "4" ) );
+  v = mapGet( m, "hot" );
+  s = v->toString( v );
+  assert( strcmp( s, "4" ) == 0 );
+  free( s );
+  freeSnapshot( snap );
+
+  // And removing the key.
+  assert( mapRemove( m, "hot" ) );
+  assert( mapGet( m, "hot" ) == NULL );
+  assert( mapGet( m, "hotter" ) != NULL );
+
+  long hits, misses;
+  mapFrontCacheStats( m, &hits, &misses );
+  assert( hits == 3 && misses == 3 );
+  freeMap( m );
+
+  // Make a cache that only has room for a few keys.
+  m = makeMapWithLimit( 8192 );
+  char key[ KEY_BUFFER ];
+  for ( int i = 0; i < 100; i++ ) {
+    sprintf( key, "k%d", i );
+    mapSet( m, key, parseInteger( "1" ) );
+
+    // Keep using the first key, so it stays in the cache.
+    assert( mapGet( m, "k0" ) != NULL );
+    assert( mapBytes( m ) <= 8192 );
+  }
+  assert( mapSize( m ) > 0 && mapSize( m ) < 100 );
+  assert( mapGet( m, "k99" ) != NULL );
+
+  // Removing everything should give back all the memory.
+  for ( int i = 0; i < 100; i++ ) {
+    sprintf( key, "k%d", i );
+    mapRemove( m, key );
+  }
+  assert( mapSize( m ) == 0 );
+  assert( mapBytes( m ) == 0 );
+  freeMap( m );
+
+  // Batched lookups should match one-at-a-time lookups, with and without a
+  // front cache, including missing keys, prefixes and invalid characters.
+  m = makeMap();
+  char names[ 50 ][ KEY_BUFFER ];
+  char const *batch[ 50 ];
+  for ( int i = 0; i < 50; i++ ) {
+    sprintf( names[ i ], "b%d", i * 7 );
+    batch[ i ] = names[ i ];
+    if ( i % 3 != 0 )
+      mapSet( m, names[ i ], parseInteger( "5" ) );
+  }
+  batch[ 10 ] = "b";
+  batch[ 20 ] = "b 7";
+  batch[ 30 ] = "";
+  Value *found[ 50 ];
+  for ( int pass = 0; pass < 2; pass++ ) {
+    if ( pass == 1 )
+      mapEnableFrontCache( m, 8 );
+    mapGetBatch( m, batch, 50, found );
+    for ( int i = 0; i < 50; i++ )
+      assert( found[ i ] == mapGet( m, batch[ i ] ) );
+  }
+  mapGetBatch( m, batch, 0, found );
+
+  // An empty map has no root to start the walks from, whether it never had
+  // any keys or they've all been removed.
+  mapRemovePrefix( m, "" );
+  Map *empty = makeMap();
+  for ( int pass = 0; pass < 2; pass++ ) {
+    for ( int i = 0; i < 50; i++ )
+      found[ i ] = (Value *) batch;
+    mapGetBatch( pass ? m : empty, batch, 50, found );
+    for ( int i = 0; i < 50; i++ )
+      assert( found[ i ] == NULL );
+  }
+  freeMap( empty );
+  freeMap( m );
+
+  // Removing by prefix fixes the size and gives back the memory, without
+  // touching keys outside the prefix or a snapshot taken earlier.
+  for ( int bg = 0; bg < 2; bg++ ) {
+    m = makeMap();
+    mapFreeInBackground( m, bg );
+    mapEnableFrontCache( m, 16 );
+    mapSet( m, "other", parseInteger( "1" ) );
+    size_t before = mapBytes( m );
+    for ( int i = 0; i < 200; i++ ) {
+      sprintf( key, "t:%d", i );
+      mapSet( m, key, parseInteger( "2" ) );
+    }
+    mapSet( m, "t", parseInteger( "3" ) );
+    assert( mapGet( m, "t:7" ) != NULL );
+    Snapshot *snap = mapSnapshot( m );
+    assert( mapRemovePrefix( m, "t:" ) == 200 );
+    assert( mapSize( m ) == 2 );
+    assert( mapGet( m, "t:7" ) == NULL );
+    assert( mapGet( m, "t" ) != NULL );
+    assert( snapshotGet( snap, "t:7" ) != NULL );
+    assert( mapRemovePrefix( m, "t:" ) == 0 );
+    assert( mapRemovePrefix( m, "t" ) == 1 );
+    assert( mapRemovePrefix( m, "x y" ) == 0 );
+    freeSnapshot( snap );
+
+    // Keys can be added back under the prefix.
+    mapSet( m, "t:7", parseInteger( "4" ) );
+    assert( mapSize( m ) == 2 );
+    assert( mapRemove( m, "t:7" ) );
+    if ( !bg )
+      assert( mapBytes( m ) == before );
+    assert( mapRemovePrefix( m, "" ) == 1 );
+    assert( mapSize( m ) == 0 );
+    freeMap( m );
+  }
+
+  // A size-limited map gets its clock entries and memory back right away.
+  m = makeMapWithLimit( 1 << 20 );
+  for ( int i = 0; i < 100; i++ ) {
+    sprintf( key, "p%d", i );
+    mapSet( m, key, parseInteger( "1" ) );
+  }
+  assert( mapRemovePrefix( m, "p" ) == 100 );
+  assert( mapSize( m ) == 0 );
+  assert( mapBytes( m ) == 0 );
+  mapSet( m, "p1", parseInteger( "1" ) );
+  assert( mapSize( m ) == 1 );
+  freeMap( m );
+
+  // A Bloom filter never turns away a key that's in the map, through
+  // growth, removals and the rebuilds they cause.
+  m = makeMap();
+  mapSet( m, "before", parseInteger( "1" ) );
+  mapEnableBloomFilter( m, 10 );
+  assert( mapGet( m, "before" ) != NULL );
+  BloomStats bloom;
+  for ( int round = 0; round < 4; round++ ) {
+    for ( int i = 0; i < 3000; i++ ) {
+      sprintf( key, "f%d:%d", round, i );
+      mapSet( m, key, parseInteger( "1" ) );
+    }
+    for ( int i = 0; i < 3000; i += 2 ) {
+      sprintf( key, "f%d:%d", round, i );
+      assert( mapRemove( m, key ) );
+    }
+    for ( int i = 0; i < 3000; i++ ) {
+      sprintf( key, "f%d:%d", round, i );
+      assert( ( mapGet( m, key ) != NULL ) == ( i % 2 == 1 ) );
+      Value *one = parseInteger( "1" );
+      assert( mapPlus( m, key, one ) == ( i % 2 == 1 ) );
+      one->destroy( one );
+    }
+  }
+  assert( mapRemovePrefix( m, "f0:" ) == 1500 );
+  assert( mapGet( m, "f0:1" ) == NULL );
+  assert( mapGet( m, "f1:1" ) != NULL );
+
+  // Keys that were never added are almost all turned away.
+  for ( int i = 0; i < 10000; i++ ) {
+    sprintf( key, "miss%d", i );
+    assert( mapGet( m, key ) == NULL );
+  }
+  mapBloomFilterStats( m, &bloom );
+  assert( bloom.bytes > 0 );
+  assert( bloom.rejected + bloom.falsePositives >= 10000 );
+  assert( bloom.rejected > 9000 );
+
+  // Wait for any rebuild that's still running, then check it happened.
+  while ( bloom.rebuilding )
+    mapBloomFilterStats( m, &bloom );
+  assert( bloom.rebuilds > 0 );
+  assert( bloom.keys >= mapSize( m ) );
+  mapDisableBloomFilter( m );
+  assert( mapGet( m, "f3:1" ) != NULL );
+  freeMap( m );
+
+  // Prefix counts and totals should stay right through every kind of
+  // change, including ones made while a snapshot shares the nodes.
+  char const *prefixes[] = { "", "n", "n1", "n12", "n2", "s", "zz" };
+  for ( int limited = 0; limited < 2; limited++ ) {
+    m = limited ? makeMapWithLimit( 1 << 16 ) : makeMap();
+    snap = NULL;
+    for ( int i = 0; i < 2000; i++ ) {
+      int k = ( i * 7919 ) % 300;
+      sprintf( key, "n%d", k );
+      switch ( i % 6 ) {
+      case 0:
+        sprintf( key, "s%d", k );
+        mapSet( m, key, parseString( "\"text\"" ) );
+        break;
+      case 1:
+        mapSet( m, key, parseDouble( "0.5" ) );
+        break;
+      case 2: {
+        Value *x = parseInteger( "3" );
+        mapPlus( m, key, x );
+        x->destroy( x );
+        break;
+      }
+      case 3:
+        mapRemove( m, key );
+        break;
+      case 4:
+        if ( i % 300 == 4 )
+          mapRemovePrefix( m, key );
+        else
+          mapSet( m, key, parseInteger( "-2" ) );
+        break;
+      default:
+        mapSet( m, key, parseInteger( "5" ) );
+      }
+      if ( i % 500 == 0 ) {
+        if ( snap != NULL )
+          freeSnapshot( snap );
+        snap = mapSnapshot( m );
+      }
+      if ( i % 97 == 0 )
+        for ( int p = 0; p < 7; p++ )
+          checkPrefix( m, prefixes[ p ] );
+    }
+    for ( int p = 0; p < 7; p++ )
+      checkPrefix( m, prefixes[ p ] );
+    assert( mapPrefixCount( m, "" ) == mapSize( m ) );
+    freeSnapshot( snap );
+    freeMap( m );
+  }
+
+  // A large double that's added and later taken away doesn't swallow the
+  // small ones added while it was there, however it goes away.
+  m = makeMap();
+  mapSet( m, "aa", parseDouble( "1e20" ) );
+  mapSet( m, "a", parseDouble( "2.5" ) );
+  mapSet( m, "ab", parseDouble( "1.25" ) );
+  mapSet( m, "b", parseDouble( "0.125" ) );
+  assert( mapRemove( m, "aa" ) );
+  assert( doubleSum( m, "a" ) == 3.75 );
+  assert( doubleSum( m, "" ) == 3.875 );
+  mapSet( m, "ac", parseDouble( "-1e20" ) );
+  mapSet( m, "b", parseDouble( "0.0625" ) );
+  mapSet( m, "ac", parseInteger( "7" ) );
+  assert( doubleSum( m, "a" ) == 3.75 );
+  assert( doubleSum( m, "" ) == 3.8125 );
+  mapSet( m, "ad", parseDouble( "3e19" ) );
+  mapSet( m, "ad1", parseDouble( "0.5" ) );
+  assert( mapRemovePrefix( m, "ad" ) == 2 );
+  assert( doubleSum( m, "a" ) == 3.75 );
+  assert( doubleSum( m, "" ) == 3.8125 );
+  freeMap( m );
+
+  // Packing the nodes into chunks keeps every key and value, leaves nodes
+  // shared with a snapshot alone, and can be done again after more changes.
+  m = makeMap();
+  mapEnableFrontCache( m, 64 );
+  for ( int i = 0; i < 5000; i++ ) {
+    sprintf( key, "L%d", i );
+    mapSet( m, key, parseInteger( "1" ) );
+  }
+  assert( mapGet( m, "L42" ) != NULL );
+  size_t bytes = mapBytes( m );
+  snap = mapSnapshot( m );
+  assert( mapOptimizeLayout( m ) == 0 );
+  mapSet( m, "L7", parseInteger( "2" ) );
+  freeSnapshot( snap );
+  assert( mapOptimizeLayout( m ) > 5000 );
+  assert( mapBytes( m ) == bytes );
+  assert( mapSize( m ) == 5000 );
+  assert( mapPrefixCount( m, "L1" ) == 1111 );
+  for ( int i = 0; i < 5000; i++ ) {
+    sprintf( key, "L%d", i );
+    int x = 0;
+    assert( integerValue( mapGet( m, key ), &x ) );
+    assert( x == ( i == 7 ? 2 : 1 ) );
+  }
+  for ( int i = 0; i < 5000; i += 2 ) {
+    sprintf( key, "L%d", i );
+    assert( mapRemove( m, key ) );
+  }
+  mapSet( m, "M", parseInteger( "3" ) );
+  assert( mapOptimizeLayout( m ) > 0 );
+  for ( int i = 0; i < 5000; i++ ) {
+    sprintf( key, "L%d", i );
+    assert( ( mapGet( m, key ) != NULL ) == ( i % 2 == 1 ) );
+  }
+  assert( mapGet( m, "M" ) != NULL );
+  freeMap( m );
+
+  // Going through the map should visit every key once, in order.
+  Visited visited = { 0, 0, "" };
+  m = makeMap();
+  mapForEach( m, countKey, &visited );
+  assert( visited.count == 0 );
+  mapSet( m, "b", parseInteger( "2" ) );
+  mapSet( m, "abc", parseInteger( "3" ) );
+  mapSet( m, "a", parseInteger( "1" ) );
+  mapSet( m, "B", parseInteger( "0" ) );
+  mapSet( m, "long-key-that-grows-the-buffer-past-its-starting-size-of-sixty-four", parseInteger( "4" ) );
+  mapForEach( m, countKey, &visited );
+  assert( visited.count == 5 );
+  assert( visited.sum == 10 );
+  assert( strcmp( visited.last, "long-key-that-grows-the-buffer-past-its-starting-size-of-sixty-four" ) == 0 );
   freeMap( m );
 
   return EXIT_SUCCESS;
@@ -0,0 +1,156 @@
+/**
+@file mapVariants
+@author Ethan Browne, efbrowne
+Generates the alphabet-specialized maps.  Each variant is the same basic trie
+as map.c, but with the alphabet's size and character mapping as compile-time
+constants, so nodes only have room for the characters that can occur.
+*/
+
+#include "mapVariants.h"
+#include <stdlib.h>
+
+/** Defines the node type and map functions for one alphabet variant.
+    FANOUT is the number of characters in the alphabet, and INDEX is a
+    function mapping a character to its position in the alphabet, or to
+    -1 for characters that can't occur in a key. */
+#define DEFINE_MAP_VARIANT( SUFFIX, FANOUT, INDEX )                     \
+                                                                        \
+  typedef struct NodeStruct##SUFFIX Node##SUFFIX;                       \
+                                                                        \
+  /* Node in the trie, with one child per alphabet character. */        \
+  struct NodeStruct##SUFFIX {                                           \
+    Value *val;                                                         \
+    Node##SUFFIX *child[ FANOUT ];                                      \
+  };                                                                    \
+                                                                        \
+  struct MapStruct##SUFFIX {                                            \
+    Node##SUFFIX *root;                                                 \
+    int size;                                                           \
+  };                                                                    \
+                                                                        \
+  Map##SUFFIX *makeMap##SUFFIX()                                        \
+  {                                                                     \
+    Map##SUFFIX *m = (Map##SUFFIX *) malloc( sizeof( Map##SUFFIX ) );   \
+    m->root = NULL;                                                     \
+    m->size = 0;                                                        \
+    return m;                                                           \
+  }                                                                     \
+                                                                        \
+  int mapSize##SUFFIX( Map##SUFFIX *m )                                 \
+  {                                                                     \
+    return m->size;                                                     \
+  }                                                                     \
+                                                                        \
+  bool mapValidKey##SUFFIX( char const *key )                           \
+  {                                                                     \
+    for ( int i = 0; key[ i ]; i++ )                                    \
+      if ( INDEX( key[ i ] ) < 0 )                                      \
+        return false;                                                   \
+    return true;                                                        \
+  }                                                                     \
+                                                                        \
+  void mapSet##SUFFIX( Map##SUFFIX *m, char const *key, Value *val )    \
+  {                                                                     \
+    Node##SUFFIX **n = &m->root;                                        \
+    for ( int i = 0; ; i++ ) {                                          \
+      if ( *n == NULL )                                                 \
+        *n = (Node##SUFFIX *) calloc( 1, sizeof( Node##SUFFIX ) );      \
+      if ( !key[ i ] )                                                  \
+        break;                                                          \
+      n = &( (*n)->child[ INDEX( key[ i ] ) ] );                        \
+    }                                                                   \
+    if ( (*n)->val != NULL )                                            \
+      (*n)->val->destroy( (*n)->val );                                  \
+    else                                                                \
+      m->size++;                                                        \
+    (*n)->val = val;                                                    \
+  }                                                                     \
+                                                                        \
+  Value *mapGet##SUFFIX( Map##SUFFIX *m, char const *key )              \
+  {                                                                     \
+    Node##SUFFIX *n = m->root;                                          \
+    for ( int i = 0; key[ i ] && n != NULL; i++ ) {                     \
+      int idx = INDEX( key[ i ] );                                      \
+      if ( idx < 0 )                                                    \
+        return NULL;                                                    \
+      n = n->child[ idx ];                                              \
+    }                                                                   \
+    return n == NULL ? NULL : n->val;                                   \
+  }                                                                     \
+                                                                        \
+  /* Removes key from the subtree at n, freeing nodes left empty. */    \
+  static bool removeHelper##SUFFIX( Map##SUFFIX *m, Node##SUFFIX **n,   \
+                                    char const *key )                   \
+  {                                                                     \
+    if ( *n == NULL )                                                   \
+      return false;                                                     \
+    if ( key[ 0 ] ) {                                                   \
+      int idx = INDEX( key[ 0 ] );                                      \
+      if ( idx < 0 || !removeHelper##SUFFIX( m, &(*n)->child[ idx ],    \
+                                             key + 1 ) )                \
+        return false;                                                   \
+    } else {                                                            \
+      if ( (*n)->val == NULL )                                          \
+        return false;                                                   \
+      (*n)->val->destroy( (*n)->val );                                  \
+      (*n)->val = NULL;                                                 \
+      m->size--;                                                        \
+    }                                                                   \
+    if ( (*n)->val != NULL )                                            \
+      return true;                                                      \
+    for ( int i = 0; i < FANOUT; i++ )                                  \
+      if ( (*n)->child[ i ] != NULL )                                   \
+        return true;                                                    \
+    free( *n );                                                         \
+    *n = NULL;                                                          \
+    return true;                                                        \
+  }                                                                     \
+                                                                        \
+  bool mapRemove##SUFFIX( Map##SUFFIX *m, char const *key )             \
+  {                                                                     \
+    return removeHelper##SUFFIX( m, &m->root, key );                    \
+  }                                                                     \
+                                                                        \
+  /* Frees the subtree at n, along with all its values. */              \
+  static void freeHelper##SUFFIX( Node##SUFFIX *n )                     \
+  {                                                                     \
+    for ( int i = 0; i < FANOUT; i++ )                                  \
+      if ( n->child[ i ] != NULL )                                      \
+        freeHelper##SUFFIX( n->child[ i ] );                            \
+    if ( n->val != NULL )                                               \
+      n->val->destroy( n->val );                                        \
+    free( n );                                                          \
+  }                                                                     \
+                                                                        \
+  void freeMap##SUFFIX( Map##SUFFIX *m )                                \
+  {                                                                     \
+    if ( m->root != NULL )                                              \
+      freeHelper##SUFFIX( m->root );                                    \
+    free( m );                                                          \
+  }
+
+/**
+Maps a lowercase letter to its position in the alphabet
+@param c the key character
+@return index of c, or -1 if c isn't a lowercase letter
+*/
+static inline int lowerIndex( char c )
+{
+  return c >= 'a' && c <= 'z' ? c - 'a' : -1;
+}
+
+/**
+Maps a hexadecimal digit to its value
+@param c the key character
+@return value of the digit c, or -1 if c isn't a lowercase hex digit
+*/
+static inline int hexIndex( char c )
+{
+  if ( c >= '0' && c <= '9' )
+    return c - '0';
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+DEFINE_MAP_VARIANT( Lower, 26, lowerIndex )
+
+DEFINE_MAP_VARIANT( Hex, 16, hexIndex )
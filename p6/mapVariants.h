@@ -0,0 +1,39 @@
+/**
+@file mapVariants
+@author Ethan Browne, efbrowne
+Maps specialized at compile time for keys drawn from a small alphabet.  Each
+variant has the basic functions from map.h, with the variant's name added as
+a suffix (e.g., makeMapLower(), mapSetHex()): make, size, set, get, remove
+and free, plus mapValidKey for checking a key against the alphabet.
+Everything else in map.h, such as mapPlus(), mapBytes(), mapForEach(), the
+prefix counts and sums, batch lookups, snapshots, the size limit, the front
+cache and the Bloom filter, is only in the general map.
+*/
+
+#ifndef MAP_VARIANTS_H
+#define MAP_VARIANTS_H
+
+#include "value.h"
+#include <stdbool.h>
+
+/** Declares the map type and functions for one alphabet variant.  The
+    functions behave like their map.h counterparts.  mapSet requires a
+    key accepted by mapValidKey; the other functions just report keys
+    with characters outside the alphabet as missing. */
+#define DECLARE_MAP_VARIANT( SUFFIX )                                   \
+  typedef struct MapStruct##SUFFIX Map##SUFFIX;                         \
+  Map##SUFFIX *makeMap##SUFFIX();                                       \
+  int mapSize##SUFFIX( Map##SUFFIX *m );                                \
+  bool mapValidKey##SUFFIX( char const *key );                          \
+  void mapSet##SUFFIX( Map##SUFFIX *m, char const *key, Value *val );   \
+  Value *mapGet##SUFFIX( Map##SUFFIX *m, char const *key );             \
+  bool mapRemove##SUFFIX( Map##SUFFIX *m, char const *key );            \
+  void freeMap##SUFFIX( Map##SUFFIX *m );
+
+/** Map for keys of lowercase letters, a-z. */
+DECLARE_MAP_VARIANT( Lower )
+
+/** Map for keys of lowercase hexadecimal digits, 0-9 and a-f. */
+DECLARE_MAP_VARIANT( Hex )
+
+#endif
@@ -0,0 +1,62 @@
+// Simple test program for the alphabet-specialized maps.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "value.h"
+#include "mapVariants.h"
+
+int main()
+{
+  // Try the lowercase map.
+  MapLower *m = makeMapLower();
+  assert( mapSizeLower( m ) == 0 );
+  assert( mapValidKeyLower( "abc" ) );
+  assert( !mapValidKeyLower( "aBc" ) );
+
+  mapSetLower( m, "abc", parseInteger( "25" ) );
+  mapSetLower( m, "ab", parseInteger( "10" ) );
+  mapSetLower( m, "abc", parseInteger( "26" ) );
+  assert( mapSizeLower( m ) == 2 );
+
+  Value *v = mapGetLower( m, "abc" );
+  assert( v != NULL );
+  char *s = v->toString( v );
+  assert( strcmp( s, "26" ) == 0 );
+  free( s );
+
+  // Keys with characters outside the alphabet just aren't there.
+  assert( mapGetLower( m, "aB" ) == NULL );
+  assert( !mapRemoveLower( m, "a~" ) );
+
+  assert( mapRemoveLower( m, "abc" ) );
+  assert( !mapRemoveLower( m, "abc" ) );
+  assert( mapGetLower( m, "abc" ) == NULL );
+  assert( mapGetLower( m, "ab" ) != NULL );
+  assert( mapSizeLower( m ) == 1 );
+  freeMapLower( m );
+
+  // Try the hex map.
+  MapHex *h = makeMapHex();
+  assert( mapValidKeyHex( "09af" ) );
+  assert( !mapValidKeyHex( "09ag" ) );
+
+  mapSetHex( h, "deadbeef", parseString( "\"beef\"" ) );
+  mapSetHex( h, "0123", parseDouble( "1.5" ) );
+  assert( mapSizeHex( h ) == 2 );
+
+  v = mapGetHex( h, "deadbeef" );
+  assert( v != NULL );
+  s = v->toString( v );
+  assert( strcmp( s, "\"beef\"" ) == 0 );
+  free( s );
+  assert( mapGetHex( h, "dead" ) == NULL );
+
+  assert( mapRemoveHex( h, "0123" ) );
+  assert( mapSizeHex( h ) == 1 );
+  freeMapHex( h );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+#!/bin/bash
+# End-to-end throughput check for the driver.  Builds optimized copies of
+# driver, workload and perfrun in perf-build, generates a few workloads,
+# times the driver on each one and writes commands/sec, peak RSS and wall
+# time to perf-results.txt.  If perf-baseline.txt exists, each workload is
+# compared against it, and the script fails if any of them got slower than
+# the baseline by more than PERF_TOLERANCE percent.
+#
+# PERF_LINES sets the number of commands in each workload (default 1000000).
+#
+# The numbers are absolute rates from whatever machine ran the script, so a
+# baseline is only meaningful on the machine that recorded it.  It isn't
+# checked in: run this once before a change and copy perf-results.txt to
+# perf-baseline.txt, then run it again after.
+
+LINES=${PERF_LINES:-1000000}
+TOLERANCE=${PERF_TOLERANCE:-15}
+BUILD=perf-build
+RESULTS=perf-results.txt
+BASELINE=perf-baseline.txt
+FLAGS="-std=c99 -O2 -Wall"
+
+mkdir -p $BUILD
+gcc $FLAGS -o $BUILD/driver driver.c command.c profile.c counters.c dump.c ring.c map.c value.c pool.c input.c -lpthread || exit 1
+gcc $FLAGS -o $BUILD/workload workload.c zipf.c -lm || exit 1
+gcc $FLAGS -o $BUILD/perfrun perfrun.c || exit 1
+
+# Name of each workload, followed by the options used to generate it.
+WORKLOADS=(
+    "uniform-int     --dist uniform --values int"
+    "zipf-int        --dist zipf --values int"
+    "zipf-string     --dist zipf --values string --key-length 16:48"
+    "uniform-mixed   --dist uniform --values mixed --mix 30:50:15:5"
+    "read-heavy      --dist zipf --values double --mix 10:85:5:0"
+)
+
+FAIL=0
+printf "%-16s %10s %12s %10s %9s\n" workload lines commands/s peak-kb wall-s > $RESULTS
+for w in "${WORKLOADS[@]}"
+do
+    set -- $w
+    NAME=$1
+    shift
+    $BUILD/workload --lines $LINES "$@" > $BUILD/$NAME.txt
+
+    # perfrun prints the wall time and peak RSS of the driver, or fails
+    # without printing them if the driver didn't run to a clean exit.
+    if ! TIMES=$($BUILD/perfrun $BUILD/$NAME.txt $BUILD/$NAME.out $BUILD/driver); then
+        printf "%-16s %10d %12s\n" $NAME $LINES failed | tee -a $RESULTS
+        echo "**** $NAME: driver failed"
+        FAIL=1
+        continue
+    fi
+    read WALL RSS <<< "$TIMES"
+    RATE=$(awk -v n=$LINES -v t=$WALL 'BEGIN { printf "%.0f", ( t > 0 ? n / t : 0 ) }')
+    printf "%-16s %10d %12d %10d %9.3f\n" $NAME $LINES $RATE $RSS $WALL | tee -a $RESULTS
+
+    if [ -f $BASELINE ]; then
+        OLD=$(awk -v n=$NAME '$1 == n && $3 ~ /^[0-9]+$/ { print $3 }' $BASELINE)
+        if [ -n "$OLD" ]; then
+            CHANGE=$(awk -v a=$RATE -v b=$OLD 'BEGIN { printf "%+.1f", ( a - b ) * 100 / b }')
+            echo "    vs baseline: $CHANGE% commands/s"
+            if awk -v c=$CHANGE -v t=$TOLERANCE 'BEGIN { exit !( c < -t ) }'; then
+                echo "**** $NAME is more than $TOLERANCE% slower than the baseline"
+                FAIL=1
+            fi
+        fi
+    fi
+done
+
+if [ $FAIL -eq 0 ]; then
+    echo "Results written to $RESULTS"
+    if [ ! -f $BASELINE ]; then
+        echo "No $BASELINE to compare with; copy $RESULTS to it to record one for this machine"
+    fi
+fi
+exit $FAIL
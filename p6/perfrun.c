@@ -0,0 +1,76 @@
+/**
+@file perfrun
+@author Ethan Browne, efbrowne
+Runs a program with its standard input and output redirected to files, then
+reports the program's wall-clock time and peak resident memory.  Used by
+perf.sh to measure the driver.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/**
+Runs the program and prints "seconds peak-kilobytes", or prints nothing and
+fails if the program couldn't be run, was killed or exited unsuccessfully
+@param argc number of command-line arguments
+@param argv input file, output file, then the program and its arguments
+@return 0 if the program ran and exited successfully
+*/
+int main( int argc, char *argv[] )
+{
+  if ( argc < 4 ) {
+    fprintf( stderr, "usage: perfrun input-file output-file program [args...]\n" );
+    return EXIT_FAILURE;
+  }
+
+  struct timespec start, end;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  pid_t pid = fork();
+  if ( pid < 0 ) {
+    perror( "fork" );
+    return EXIT_FAILURE;
+  }
+  if ( pid == 0 ) {
+    int in = open( argv[ 1 ], O_RDONLY );
+    int out = open( argv[ 2 ], O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( in < 0 || out < 0 ) {
+      perror( "open" );
+      _exit( 127 );
+    }
+    dup2( in, STDIN_FILENO );
+    dup2( out, STDOUT_FILENO );
+    execv( argv[ 3 ], argv + 3 );
+    perror( argv[ 3 ] );
+    _exit( 127 );
+  }
+
+  int status;
+  struct rusage usage;
+  if ( wait4( pid, &status, 0, &usage ) < 0 ) {
+    perror( "wait4" );
+    return EXIT_FAILURE;
+  }
+  clock_gettime( CLOCK_MONOTONIC, &end );
+
+  // A run that didn't finish normally isn't a timing, so don't report one.
+  if ( WIFSIGNALED( status ) ) {
+    fprintf( stderr, "%s: killed by signal %d\n", argv[ 3 ], WTERMSIG( status ) );
+    return EXIT_FAILURE;
+  }
+  if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) {
+    fprintf( stderr, "%s: exited with status %d\n", argv[ 3 ], WEXITSTATUS( status ) );
+    return EXIT_FAILURE;
+  }
+
+  printf( "%.3f %ld\n", end.tv_sec - start.tv_sec + ( end.tv_nsec - start.tv_nsec ) / 1e9,
+          usage.ru_maxrss );
+  return EXIT_SUCCESS;
+}
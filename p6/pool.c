@@ -0,0 +1,295 @@
+/**
+@file pool
+@author Ethan Browne, efbrowne
+Pools of fixed-size objects, with per-thread free lists backed by a shared
+depot and large slabs.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "pool.h"
+#include <stdlib.h>
+#include <stdbool.h>
+
+/** Number of objects moved between a thread's list and the depot at once. */
+#define POOL_BATCH 64
+
+/** Number of objects carved from each slab. */
+#define SLAB_OBJECTS 1024
+
+/** A thread's free objects from one pool. */
+typedef struct {
+  /** First free object, linked through the first word of each one. */
+  void *head;
+
+  /** Number of objects in the list. */
+  int count;
+
+  /** Objects this thread allocated from the pool, minus the ones it freed.
+      Only this thread writes it, but poolStats() reads it. */
+  long live;
+} FreeList;
+
+/** Everything one thread keeps for the pools. */
+typedef struct ThreadCacheStruct {
+  /** Free lists, indexed by pool id. */
+  FreeList lists[ MAX_POOLS ];
+
+  /** True once the thread is on the list of caches. */
+  bool registered;
+
+  /** Next thread's cache. */
+  struct ThreadCacheStruct *next;
+} ThreadCache;
+
+/** This thread's cache. */
+static __thread ThreadCache cache;
+
+/** Caches of all the running threads that have used a pool. */
+static ThreadCache *caches;
+
+/** The pool using each id. */
+static Pool *pools[ MAX_POOLS ];
+
+/** Number of pool ids handed out. */
+static int poolCount;
+
+/** Lock for pool ids and the list of caches. */
+static pthread_mutex_t poolsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Key whose destructor runs when a thread that used a pool exits. */
+static pthread_key_t exitKey;
+
+/** Makes sure exitKey is created just once. */
+static pthread_once_t exitOnce = PTHREAD_ONCE_INIT;
+
+/**
+Returns the object following the given one in a free list
+@param obj the object
+@return the next object, or NULL
+*/
+static void *nextFree( void *obj )
+{
+  return *(void **) obj;
+}
+
+/**
+Links an object in front of another one in a free list
+@param obj the object
+@param next the object to put after it
+*/
+static void setNextFree( void *obj, void *next )
+{
+  *(void **) obj = next;
+}
+
+/**
+Moves up to n objects from the front of one list onto another
+@param from list to take objects from
+@param fromCount number of objects in from, updated
+@param to list to add the objects to
+@param toCount number of objects in to, updated
+@param n number of objects to move
+*/
+static void moveFree( void **from, long *fromCount, void **to, long *toCount, int n )
+{
+  while ( n-- > 0 && *from ) {
+    void *obj = *from;
+    *from = nextFree( obj );
+    setNextFree( obj, *to );
+    *to = obj;
+    ( *fromCount )--;
+    ( *toCount )++;
+  }
+}
+
+/**
+Takes an exiting thread's cache off the list, giving its free objects back to
+the depots and adding its counts to the pools
+@param arg unused
+*/
+static void threadExit( void *arg )
+{
+  pthread_mutex_lock( &poolsLock );
+  ThreadCache **link = &caches;
+  while ( *link != &cache )
+    link = &( *link )->next;
+  *link = cache.next;
+  cache.registered = false;
+
+  for ( int i = 0; i < poolCount; i++ ) {
+    FreeList *list = &cache.lists[ i ];
+    Pool *p = pools[ i ];
+    long left = list->count;
+    pthread_mutex_lock( &p->lock );
+    moveFree( &list->head, &left, &p->depot, &p->depotCount, list->count );
+    p->live += list->live;
+    pthread_mutex_unlock( &p->lock );
+    list->count = 0;
+    list->live = 0;
+  }
+  pthread_mutex_unlock( &poolsLock );
+}
+
+/**
+Creates the key used to notice threads exiting
+*/
+static void makeExitKey()
+{
+  pthread_key_create( &exitKey, threadExit );
+}
+
+/**
+Puts this thread's cache on the list, the first time it uses any pool
+*/
+static void registerThread()
+{
+  pthread_once( &exitOnce, makeExitKey );
+  pthread_setspecific( exitKey, &exitKey );
+  pthread_mutex_lock( &poolsLock );
+  cache.next = caches;
+  caches = &cache;
+  cache.registered = true;
+  pthread_mutex_unlock( &poolsLock );
+}
+
+/**
+Gets this thread's free list for a pool, giving the pool its id and
+registering the thread the first time either is needed
+@param p the pool
+@return the free list
+*/
+static FreeList *freeList( Pool *p )
+{
+  if ( !cache.registered )
+    registerThread();
+
+  int id = __atomic_load_n( &p->id, __ATOMIC_ACQUIRE );
+  if ( id < 0 ) {
+    pthread_mutex_lock( &poolsLock );
+    if ( p->id < 0 ) {
+      if ( poolCount >= MAX_POOLS )
+        abort();
+      pools[ poolCount ] = p;
+      __atomic_store_n( &p->id, poolCount++, __ATOMIC_RELEASE );
+    }
+    id = p->id;
+    pthread_mutex_unlock( &poolsLock );
+  }
+  return &cache.lists[ id ];
+}
+
+/**
+Adds to a thread's count of live objects, in a way poolStats() can read from
+another thread
+@param list the thread's free list
+@param n amount to add
+*/
+static void addLive( FreeList *list, long n )
+{
+  __atomic_store_n( &list->live, list->live + n, __ATOMIC_RELAXED );
+}
+
+#ifndef POOL_MALLOC
+
+/**
+Fills a thread's empty free list from the depot, carving a new slab if the
+depot is empty.  Must be called with the pool locked.
+@param p the pool
+@param list the thread's list for this pool
+*/
+static void refill( Pool *p, FreeList *list )
+{
+  long count = list->count;
+  if ( p->depotCount > 0 ) {
+    moveFree( &p->depot, &p->depotCount, &list->head, &count, POOL_BATCH );
+    list->count = count;
+    return;
+  }
+
+  // Round the size up so every object is aligned like a pointer or better.
+  size_t size = ( p->size + sizeof( void * ) - 1 ) / sizeof( void * ) * sizeof( void * );
+  if ( size < sizeof( void * ) )
+    size = sizeof( void * );
+  char *slab = (char *) malloc( size * SLAB_OBJECTS );
+  if ( slab == NULL )
+    abort();
+  p->slabs++;
+  p->capacity += SLAB_OBJECTS;
+
+  // Keep a batch for this thread and put the rest in the depot.
+  for ( int i = SLAB_OBJECTS - 1; i >= 0; i-- ) {
+    if ( i < POOL_BATCH ) {
+      setNextFree( slab + i * size, list->head );
+      list->head = slab + i * size;
+      list->count++;
+    } else {
+      setNextFree( slab + i * size, p->depot );
+      p->depot = slab + i * size;
+      p->depotCount++;
+    }
+  }
+}
+
+#endif
+
+void *poolAlloc( Pool *p )
+{
+  FreeList *list = freeList( p );
+  addLive( list, 1 );
+#ifdef POOL_MALLOC
+  return malloc( p->size );
+#else
+  if ( list->head == NULL ) {
+    pthread_mutex_lock( &p->lock );
+    refill( p, list );
+    pthread_mutex_unlock( &p->lock );
+  }
+  void *obj = list->head;
+  list->head = nextFree( obj );
+  list->count--;
+  return obj;
+#endif
+}
+
+void poolFree( Pool *p, void *obj )
+{
+  if ( obj == NULL )
+    return;
+  FreeList *list = freeList( p );
+  addLive( list, -1 );
+#ifdef POOL_MALLOC
+  free( obj );
+#else
+  setNextFree( obj, list->head );
+  list->head = obj;
+  list->count++;
+
+  // Don't let one thread hoard objects another thread is allocating.
+  if ( list->count >= 2 * POOL_BATCH ) {
+    long count = list->count;
+    pthread_mutex_lock( &p->lock );
+    moveFree( &list->head, &count, &p->depot, &p->depotCount, POOL_BATCH );
+    pthread_mutex_unlock( &p->lock );
+    list->count = count;
+  }
+#endif
+}
+
+void poolStats( Pool *p, PoolStats *stats )
+{
+  FreeList *mine = freeList( p );
+  pthread_mutex_lock( &poolsLock );
+  pthread_mutex_lock( &p->lock );
+  stats->name = p->name;
+  stats->size = p->size;
+  stats->slabs = p->slabs;
+  stats->capacity = p->capacity;
+  stats->depot = p->depotCount;
+  stats->live = p->live;
+  int id = mine - cache.lists;
+  for ( ThreadCache *c = caches; c; c = c->next )
+    stats->live += __atomic_load_n( &c->lists[ id ].live, __ATOMIC_RELAXED );
+  pthread_mutex_unlock( &p->lock );
+  pthread_mutex_unlock( &poolsLock );
+}
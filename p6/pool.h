@@ -0,0 +1,98 @@
+/**
+@file pool
+@author Ethan Browne, efbrowne
+Pools of fixed-size objects.  Each thread keeps its own list of free objects,
+so most allocations and frees don't lock anything.  A thread refills its list
+in batches from the pool's shared depot, which gets new objects by carving up
+large slabs, and hands a batch back when it has too many.  Slabs are never
+returned to the system.
+
+Building with -DPOOL_MALLOC makes every pool use plain malloc() and free(),
+so tools like valgrind can check each object separately.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/** Most pools a program can have. */
+#define MAX_POOLS 8
+
+/** A pool of objects of one size.  Define pools with POOL_INITIALIZER. */
+typedef struct {
+  /** Name of the pool, for reports. */
+  char const *name;
+
+  /** Size of each object. */
+  size_t size;
+
+  /** Index of this pool in each thread's lists, or -1 before first use. */
+  int id;
+
+  /** Lock for the fields below. */
+  pthread_mutex_t lock;
+
+  /** Free objects shared by all the threads, linked through their first
+      word. */
+  void *depot;
+
+  /** Number of objects in the depot. */
+  long depotCount;
+
+  /** Number of slabs allocated. */
+  long slabs;
+
+  /** Number of objects ever carved from slabs. */
+  long capacity;
+
+  /** Objects allocated minus objects freed, by threads that have exited.
+      Threads that are still running keep their own counts. */
+  long live;
+} Pool;
+
+/** Initializer for a pool of objects of the given type.
+    @param name name of the pool.
+    @param type type of the objects. */
+#define POOL_INITIALIZER( name, type ) \
+  { ( name ), sizeof( type ), -1, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0 }
+
+/** Occupancy of a pool, as reported by poolStats(). */
+typedef struct {
+  /** Name of the pool. */
+  char const *name;
+
+  /** Size of each object. */
+  size_t size;
+
+  /** Number of slabs allocated. */
+  long slabs;
+
+  /** Number of objects carved from slabs, whether in use or free. */
+  long capacity;
+
+  /** Number of objects in use. */
+  long live;
+
+  /** Number of free objects in the shared depot.  The rest of the free
+      objects are in per-thread lists. */
+  long depot;
+} PoolStats;
+
+/** Get an object from a pool.
+    @param p the pool.
+    @return an uninitialized object of the pool's size. */
+void *poolAlloc( Pool *p );
+
+/** Return an object to the pool it came from.
+    @param p the pool.
+    @param obj the object, or NULL to do nothing. */
+void poolFree( Pool *p, void *obj );
+
+/** Report how full a pool is.
+    @param p the pool.
+    @param stats filled in with the pool's occupancy. */
+void poolStats( Pool *p, PoolStats *stats );
+
+#endif
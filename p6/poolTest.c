@@ -0,0 +1,93 @@
+// Simple test program for the object pools.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+// Number of objects to allocate at once, enough to need several slabs.
+#define OBJECTS 5000
+
+// Object type for the test pool.
+typedef struct {
+  int id;
+  double x;
+} Thing;
+
+static Pool pool = POOL_INITIALIZER( "thing", Thing );
+
+// Allocate and free a batch of objects on another thread.
+static void *worker( void *arg )
+{
+  Thing **things = (Thing **) arg;
+  for ( int i = 0; i < OBJECTS; i++ ) {
+    things[ i ] = (Thing *) poolAlloc( &pool );
+    things[ i ]->id = -i;
+  }
+  for ( int i = 0; i < OBJECTS; i++ ) {
+    assert( things[ i ]->id == -i );
+    poolFree( &pool, things[ i ] );
+  }
+  return NULL;
+}
+
+int main()
+{
+  PoolStats stats;
+  poolStats( &pool, &stats );
+  assert( strcmp( stats.name, "thing" ) == 0 );
+  assert( stats.size == sizeof( Thing ) );
+  assert( stats.live == 0 );
+
+  // Every object should be separate from all the others.
+  Thing **things = (Thing **) malloc( OBJECTS * sizeof( Thing * ) );
+  for ( int i = 0; i < OBJECTS; i++ ) {
+    things[ i ] = (Thing *) poolAlloc( &pool );
+    things[ i ]->id = i;
+    things[ i ]->x = i * 0.5;
+  }
+  for ( int i = 0; i < OBJECTS; i++ ) {
+    assert( things[ i ]->id == i );
+    assert( things[ i ]->x == i * 0.5 );
+  }
+
+  poolStats( &pool, &stats );
+  assert( stats.live == OBJECTS );
+  assert( stats.capacity >= OBJECTS || stats.slabs == 0 );
+
+  // Freed objects get reused, so the pool shouldn't grow.
+  for ( int i = 0; i < OBJECTS; i++ )
+    poolFree( &pool, things[ i ] );
+  poolFree( &pool, NULL );
+  poolStats( &pool, &stats );
+  assert( stats.live == 0 );
+  long capacity = stats.capacity;
+
+  for ( int i = 0; i < OBJECTS; i++ )
+    things[ i ] = (Thing *) poolAlloc( &pool );
+  poolStats( &pool, &stats );
+  assert( stats.live == OBJECTS );
+  assert( stats.capacity == capacity );
+  for ( int i = 0; i < OBJECTS; i++ )
+    poolFree( &pool, things[ i ] );
+
+  // Objects freed by a thread that exits go back to the depot, not lost.
+  pthread_t tid;
+  pthread_create( &tid, NULL, worker, things );
+  pthread_join( tid, NULL );
+  poolStats( &pool, &stats );
+  assert( stats.live == 0 );
+  if ( stats.slabs > 0 ) {
+    // Everything not in this thread's list must be in the depot, and a
+    // thread keeps fewer than 128 free objects of its own.
+    assert( stats.capacity - stats.depot < 128 );
+  }
+
+  free( things );
+  return EXIT_SUCCESS;
+}
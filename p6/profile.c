@@ -0,0 +1,141 @@
+/**
+@file profile
+@author Ethan Browne, efbrowne
+Latency histograms for the driver's commands.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "profile.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/** Longest line in a profile report. */
+#define REPORT_LINE 128
+
+/**
+Initialize a profile with empty histograms
+@param p the profile to initialize
+*/
+void initProfile( Profile *p )
+{
+  memset( p, 0, sizeof( Profile ) );
+}
+
+/**
+Return the current time from a monotonic clock
+@return the time in nanoseconds
+*/
+long profileClock()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+Finds the bucket for a latency.  Values below SUB_BUCKETS get a bucket each;
+above that, the top SUB_BUCKET_BITS + 1 bits of the value pick the bucket.
+@param ns the latency
+@return index of the bucket
+*/
+static int bucketOf( long ns )
+{
+  if ( ns < SUB_BUCKETS )
+    return ns < 0 ? 0 : ns;
+  int shift = 63 - __builtin_clzl( ns ) - SUB_BUCKET_BITS;
+  return ( shift + 1 ) * SUB_BUCKETS + ( ( ns >> shift ) & ( SUB_BUCKETS - 1 ) );
+}
+
+/**
+Finds the largest latency that falls in a bucket
+@param bucket index of the bucket
+@return the top of the bucket's range
+*/
+static long bucketTop( int bucket )
+{
+  if ( bucket < SUB_BUCKETS )
+    return bucket;
+  int shift = bucket / SUB_BUCKETS - 1;
+  long base = (long) ( SUB_BUCKETS + bucket % SUB_BUCKETS ) << shift;
+  return base + ( 1L << shift ) - 1;
+}
+
+/**
+Record how long one command took
+@param p profile to record in
+@param type the type of command
+@param ns the command's latency in nanoseconds
+*/
+void recordLatency( Profile *p, CommandType type, long ns )
+{
+  Histogram *h = &p->hist[ type ];
+  h->counts[ bucketOf( ns ) ]++;
+  h->total++;
+  if ( ns > h->max )
+    h->max = ns;
+}
+
+/**
+Add all the latencies from one profile into another
+@param p profile to add to
+@param other profile to add from
+*/
+void mergeProfile( Profile *p, Profile const *other )
+{
+  for ( int t = 0; t < COMMAND_TYPES; t++ ) {
+    Histogram *h = &p->hist[ t ];
+    Histogram const *o = &other->hist[ t ];
+    for ( int i = 0; i < HISTOGRAM_BUCKETS; i++ )
+      h->counts[ i ] += o->counts[ i ];
+    h->total += o->total;
+    if ( o->max > h->max )
+      h->max = o->max;
+  }
+}
+
+/**
+Return the latency at the given percentile of a histogram
+@param h the histogram
+@param percentile the percentile, from 0 to 100
+@return the latency, rounded up to the end of its bucket
+*/
+long histogramPercentile( Histogram const *h, double percentile )
+{
+  long rank = h->total * percentile / 100.0 + 0.5;
+  if ( rank < 1 )
+    rank = 1;
+  long seen = 0;
+  for ( int i = 0; i < HISTOGRAM_BUCKETS; i++ ) {
+    seen += h->counts[ i ];
+    if ( seen >= rank )
+      return bucketTop( i ) < h->max ? bucketTop( i ) : h->max;
+  }
+  return h->max;
+}
+
+/**
+Write a table of counts and latency percentiles for every command type that
+has been run
+@param p the profile to report
+@param out buffer for the report
+*/
+void reportProfile( Profile const *p, Output *out )
+{
+  char line[ REPORT_LINE ];
+  int len = snprintf( line, sizeof( line ), "%-8s %10s %9s %9s %9s %9s %9s (ns)\n",
+                      "command", "count", "p50", "p90", "p99", "p999", "max" );
+  appendOutput( out, line, len );
+  for ( int t = 0; t < COMMAND_TYPES; t++ ) {
+    Histogram const *h = &p->hist[ t ];
+    if ( h->total == 0 )
+      continue;
+    len = snprintf( line, sizeof( line ), "%-8s %10ld %9ld %9ld %9ld %9ld %9ld\n",
+                    commandName( t ), h->total,
+                    histogramPercentile( h, 50 ), histogramPercentile( h, 90 ),
+                    histogramPercentile( h, 99 ), histogramPercentile( h, 99.9 ),
+                    h->max );
+    appendOutput( out, line, len );
+  }
+}
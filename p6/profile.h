@@ -0,0 +1,72 @@
+/**
+@file profile
+@author Ethan Browne, efbrowne
+Latency histograms for the driver's commands.  Each histogram is log-linear,
+like an HDR histogram: every power of two is split into the same number of
+equal-width buckets, so recording costs a few instructions and percentiles are
+accurate to about 3% over the whole range.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "command.h"
+
+/** Number of bits of precision kept within each power of two. */
+#define SUB_BUCKET_BITS 5
+
+/** Number of buckets per power of two. */
+#define SUB_BUCKETS ( 1 << SUB_BUCKET_BITS )
+
+/** Total buckets, enough for any latency that fits in 63 bits. */
+#define HISTOGRAM_BUCKETS ( ( 64 - SUB_BUCKET_BITS ) * SUB_BUCKETS )
+
+/** Histogram of latencies, in nanoseconds. */
+typedef struct {
+  /** Number of latencies recorded in each bucket. */
+  long counts[ HISTOGRAM_BUCKETS ];
+
+  /** Total number of latencies recorded. */
+  long total;
+
+  /** Largest latency recorded. */
+  long max;
+} Histogram;
+
+/** Latency histograms for every type of command. */
+typedef struct {
+  Histogram hist[ COMMAND_TYPES ];
+} Profile;
+
+/** Initialize a profile with empty histograms.
+    @param p the profile to initialize. */
+void initProfile( Profile *p );
+
+/** Return the current time from a monotonic clock.
+    @return the time in nanoseconds. */
+long profileClock();
+
+/** Record how long one command took.
+    @param p profile to record in.
+    @param type the type of command.
+    @param ns the command's latency in nanoseconds. */
+void recordLatency( Profile *p, CommandType type, long ns );
+
+/** Add all the latencies from one profile into another.
+    @param p profile to add to.
+    @param other profile to add from. */
+void mergeProfile( Profile *p, Profile const *other );
+
+/** Return the latency at the given percentile of a histogram.
+    @param h the histogram.
+    @param percentile the percentile, from 0 to 100.
+    @return the latency, rounded up to the end of its bucket. */
+long histogramPercentile( Histogram const *h, double percentile );
+
+/** Write a table of counts and p50/p90/p99/p999/max latencies for every
+    command type that has been run.
+    @param p the profile to report.
+    @param out buffer for the report. */
+void reportProfile( Profile const *p, Output *out );
+
+#endif
@@ -0,0 +1,120 @@
+/**
+@file ring
+@author Ethan Browne, efbrowne
+Bounded single-producer, single-consumer rings of pointers.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ring.h"
+#include <stdlib.h>
+#include <sched.h>
+
+/** Number of times a side checks the ring again right away when it has to
+    wait. */
+#define RING_SPINS 64
+
+/** Number of times it checks again after giving up the processor, before
+    going to sleep.  When the threads share a processor, this lets the other
+    side fill or drain the ring without a wakeup for every pointer. */
+#define RING_YIELDS 100
+
+void initRing( Ring *r, int capacity )
+{
+  unsigned long slots = 1;
+  while ( slots < capacity )
+    slots *= 2;
+  r->slots = (void **) malloc( slots * sizeof( void * ) );
+  r->mask = slots - 1;
+  pthread_mutex_init( &r->lock, NULL );
+  pthread_cond_init( &r->notEmpty, NULL );
+  pthread_cond_init( &r->notFull, NULL );
+  r->consumerWaiting = r->producerWaiting = 0;
+  r->tail = r->headSeen = 0;
+  r->head = r->tailSeen = 0;
+}
+
+void freeRing( Ring *r )
+{
+  pthread_cond_destroy( &r->notEmpty );
+  pthread_cond_destroy( &r->notFull );
+  pthread_mutex_destroy( &r->lock );
+  free( r->slots );
+}
+
+/**
+Waits for the other side of a ring to move its index past the value last seen,
+spinning for a while and then sleeping
+@param r the ring
+@param index the other side's index
+@param seen the value of the index last seen
+@param waiting this side's flag for being asleep
+@param wake condition the other side signals when it moves its index
+@return the new value of the index
+*/
+static unsigned long waitForIndex( Ring *r, unsigned long *index, unsigned long seen,
+                                   int *waiting, pthread_cond_t *wake )
+{
+  unsigned long now;
+  for ( int i = 0; i < RING_SPINS + RING_YIELDS; i++ ) {
+    now = __atomic_load_n( index, __ATOMIC_ACQUIRE );
+    if ( now != seen )
+      return now;
+    if ( i >= RING_SPINS )
+      sched_yield();
+  }
+
+  // Say we're going to sleep before checking one last time.  The other side
+  // moves its index before checking the flag, so one of us sees the other.
+  pthread_mutex_lock( &r->lock );
+  __atomic_store_n( waiting, 1, __ATOMIC_SEQ_CST );
+  while ( ( now = __atomic_load_n( index, __ATOMIC_SEQ_CST ) ) == seen )
+    pthread_cond_wait( wake, &r->lock );
+  __atomic_store_n( waiting, 0, __ATOMIC_RELAXED );
+  pthread_mutex_unlock( &r->lock );
+  return now;
+}
+
+/**
+Wakes the other side of a ring, if it's asleep, after this side has moved its
+index
+@param r the ring
+@param waiting the other side's flag for being asleep
+@param wake condition the other side sleeps on
+*/
+static void wakeOther( Ring *r, int *waiting, pthread_cond_t *wake )
+{
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  if ( __atomic_load_n( waiting, __ATOMIC_RELAXED ) ) {
+    pthread_mutex_lock( &r->lock );
+    pthread_cond_signal( wake );
+    pthread_mutex_unlock( &r->lock );
+  }
+}
+
+void ringPush( Ring *r, void *item )
+{
+  if ( r->tail - r->headSeen > r->mask ) {
+    r->headSeen = __atomic_load_n( &r->head, __ATOMIC_ACQUIRE );
+    if ( r->tail - r->headSeen > r->mask )
+      r->headSeen = waitForIndex( r, &r->head, r->headSeen, &r->producerWaiting,
+                                  &r->notFull );
+  }
+  r->slots[ r->tail & r->mask ] = item;
+  __atomic_store_n( &r->tail, r->tail + 1, __ATOMIC_RELEASE );
+  wakeOther( r, &r->consumerWaiting, &r->notEmpty );
+}
+
+void *ringPop( Ring *r )
+{
+  if ( r->head == r->tailSeen ) {
+    r->tailSeen = __atomic_load_n( &r->tail, __ATOMIC_ACQUIRE );
+    if ( r->head == r->tailSeen )
+      r->tailSeen = waitForIndex( r, &r->tail, r->tailSeen, &r->consumerWaiting,
+                                  &r->notEmpty );
+  }
+  void *item = r->slots[ r->head & r->mask ];
+  __atomic_store_n( &r->head, r->head + 1, __ATOMIC_RELEASE );
+  wakeOther( r, &r->producerWaiting, &r->notFull );
+  return item;
+}
@@ -0,0 +1,84 @@
+/**
+@file ring
+@author Ethan Browne, efbrowne
+Bounded rings of pointers connecting one producer thread to one consumer
+thread.  Pushing and popping don't take a lock: each side writes only its own
+index, and reads the other side's index again only when the copy it kept says
+the ring looks full or empty.  A thread that finds the ring full or empty spins
+briefly, then sleeps until the other side makes progress.
+*/
+
+#ifndef RING_H
+#define RING_H
+
+#include <pthread.h>
+
+/** Size of a cache line, for keeping the two sides' fields apart. */
+#define RING_LINE 64
+
+/** A ring of pointers with one producer and one consumer. */
+typedef struct {
+  /** The slots, a power of two of them. */
+  void **slots;
+
+  /** Number of slots minus one, for masking indices. */
+  unsigned long mask;
+
+  /** Lock for going to sleep and waking up. */
+  pthread_mutex_t lock;
+
+  /** Signaled when the ring stops being empty. */
+  pthread_cond_t notEmpty;
+
+  /** Signaled when the ring stops being full. */
+  pthread_cond_t notFull;
+
+  /** Set while the consumer is asleep, or about to be. */
+  int consumerWaiting;
+
+  /** Set while the producer is asleep, or about to be. */
+  int producerWaiting;
+
+  char pad0[ RING_LINE ];
+
+  /** Number of pointers ever pushed.  Written only by the producer. */
+  unsigned long tail;
+
+  /** The producer's copy of head, read again only when the ring looks
+      full. */
+  unsigned long headSeen;
+
+  char pad1[ RING_LINE ];
+
+  /** Number of pointers ever popped.  Written only by the consumer. */
+  unsigned long head;
+
+  /** The consumer's copy of tail, read again only when the ring looks
+      empty. */
+  unsigned long tailSeen;
+
+  char pad2[ RING_LINE ];
+} Ring;
+
+/** Set up an empty ring.
+    @param r the ring.
+    @param capacity number of slots, rounded up to a power of two. */
+void initRing( Ring *r, int capacity );
+
+/** Free the memory used by a ring.
+    @param r the ring. */
+void freeRing( Ring *r );
+
+/** Add a pointer to the ring, waiting for room if it's full.  Only the
+    producer thread may call this.
+    @param r the ring.
+    @param item the pointer. */
+void ringPush( Ring *r, void *item );
+
+/** Take the oldest pointer from the ring, waiting for one if it's empty.
+    Only the consumer thread may call this.
+    @param r the ring.
+    @return the pointer. */
+void *ringPop( Ring *r );
+
+#endif
@@ -0,0 +1,66 @@
+// Simple test program for the single-producer, single-consumer rings.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ring.h"
+
+// Number of pointers sent through the ring, many times its capacity.
+#define ITEMS 200000
+
+// Capacity of the ring, small so both sides often have to wait.
+#define CAPACITY 8
+
+static Ring ring;
+
+// Push the numbers 1 to ITEMS, then NULL.
+static void *producer( void *arg )
+{
+  for ( uintptr_t i = 1; i <= ITEMS; i++ )
+    ringPush( &ring, (void *) i );
+  ringPush( &ring, NULL );
+  return NULL;
+}
+
+// Wait long enough for the consumer to go to sleep, then push one pointer.
+static void *slowProducer( void *arg )
+{
+  struct timespec pause = { 0, 100000000 };
+  nanosleep( &pause, NULL );
+  ringPush( &ring, arg );
+  return NULL;
+}
+
+int main()
+{
+  // The capacity is rounded up to a power of two.
+  initRing( &ring, 5 );
+  assert( ring.mask == 7 );
+  freeRing( &ring );
+
+  // Everything comes out once, in order, with the ring filling up and
+  // emptying over and over.
+  initRing( &ring, CAPACITY );
+  pthread_t thread;
+  pthread_create( &thread, NULL, producer, NULL );
+  uintptr_t expected = 1;
+  void *item;
+  while ( ( item = ringPop( &ring ) ) != NULL )
+    assert( (uintptr_t) item == expected++ );
+  assert( expected == ITEMS + 1 );
+  pthread_join( thread, NULL );
+
+  // A consumer that went to sleep on an empty ring is woken by the next push.
+  pthread_create( &thread, NULL, slowProducer, &ring );
+  assert( ringPop( &ring ) == &ring );
+  pthread_join( thread, NULL );
+  freeRing( &ring );
+
+  return EXIT_SUCCESS;
+}
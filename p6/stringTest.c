@@ -77,5 +77,42 @@ int main()
   v4->destroy( v4 );
   v5->destroy( v5 );
 
+  // Interned strings with the same text should share their characters.
+  setStringInterning( true );
+  Value *i1 = parseString( "\"ok\"" );
+  Value *i2 = parseString( " \"ok\" " );
+  Value *i3 = parseString( "\"error\"" );
+  Value *i4 = copyValue( i1 );
+  InternStats stats;
+  internStats( &stats );
+  assert( stats.strings == 2 );
+  assert( stats.values == 4 );
+  assert( stats.bytes > 0 );
+
+  s1 = i2->toString( i2 );
+  assert( strcmp( s1, "\"ok\"" ) == 0 );
+  free( s1 );
+
+  // Changing one of them shouldn't change the others.
+  assert( i1->plus( i1, i3 ) );
+  s1 = i1->toString( i1 );
+  assert( strcmp( s1, "\"okerror\"" ) == 0 );
+  free( s1 );
+  s1 = i4->toString( i4 );
+  assert( strcmp( s1, "\"ok\"" ) == 0 );
+  free( s1 );
+  internStats( &stats );
+  assert( stats.strings == 2 );
+  assert( stats.values == 3 );
+
+  // The table empties as the values go away.
+  i1->destroy( i1 );
+  i2->destroy( i2 );
+  i3->destroy( i3 );
+  i4->destroy( i4 );
+  internStats( &stats );
+  assert( stats.strings == 0 && stats.values == 0 && stats.bytes == 0 );
+  setStringInterning( false );
+
   return EXIT_SUCCESS;
 }
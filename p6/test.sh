@@ -141,6 +141,142 @@ runTest() {
   return 0
 }
 
+# Run a test of the driver program in batch mode, where only the responses
+# are printed.
+runBatchTest() {
+  TESTNO=$1
+
+  echo "Batch test $TESTNO"
+  rm -f output.txt stderr.txt
+
+  echo "   ./driver --batch < input-$TESTNO.txt > output.txt 2> stderr.txt"
+  ./driver --batch < input-$TESTNO.txt > output.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus 0 "$ASTATUS" ||
+     ! checkFile "Program output" "expected-batch-$TESTNO.txt" "output.txt" ||
+     ! checkEmpty "Stderr output" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+
+  echo "Batch test $TESTNO PASS"
+  return 0
+}
+
+# Run a test of the driver program in pipelined mode, which should print
+# exactly what it prints when it runs commands one at a time.
+runPipelineTest() {
+  TESTNO=$1
+
+  echo "Pipeline test $TESTNO"
+  rm -f output.txt stderr.txt
+
+  echo "   ./driver --pipeline < input-$TESTNO.txt > output.txt 2> stderr.txt"
+  ./driver --pipeline < input-$TESTNO.txt > output.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus 0 "$ASTATUS" ||
+     ! checkFile "Program output" "expected-$TESTNO.txt" "output.txt" ||
+     ! checkEmpty "Stderr output" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+
+  echo "Pipeline test $TESTNO PASS"
+  return 0
+}
+
+# Run a test of the driver program in parallel mode, with the given number
+# of threads, which should print exactly what it prints when it runs
+# commands one at a time.  A dump it saves holds the same lines as the
+# sequential one, but partition by partition, so those are compared sorted.
+runParallelTest() {
+  TESTNO=$1
+  THREADS=$2
+
+  echo "Parallel test $TESTNO, $THREADS threads"
+  rm -f output.txt stderr.txt dump-$TESTNO.txt
+
+  echo "   ./driver --parallel $THREADS < input-$TESTNO.txt > output.txt 2> stderr.txt"
+  ./driver --parallel $THREADS < input-$TESTNO.txt > output.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus 0 "$ASTATUS" ||
+     ! checkFile "Program output" "expected-$TESTNO.txt" "output.txt" ||
+     ! checkEmpty "Stderr output" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+  if [ -f "expected-dump-$TESTNO.txt" ]; then
+      echo "   diff <(sort expected-dump-$TESTNO.txt) <(sort dump-$TESTNO.txt)"
+      if ! diff -q <(sort "expected-dump-$TESTNO.txt") <(sort "dump-$TESTNO.txt") >/dev/null 2>&1; then
+          fail "FAILED - Dump file (dump-$TESTNO.txt) doesn't have the keys in expected-dump-$TESTNO.txt"
+          return 1
+      fi
+      rm -f dump-$TESTNO.txt
+  fi
+
+  echo "Parallel test $TESTNO, $THREADS threads PASS"
+  return 0
+}
+
+# Run a test of the driver program with performance counters, which should
+# print exactly what it prints without them, plus a report (or a note that
+# the counters are unavailable) on standard error.
+runCountersTest() {
+  TESTNO=$1
+
+  echo "Counters test $TESTNO"
+  rm -f output.txt stderr.txt
+
+  echo "   ./driver --perf-counters < input-$TESTNO.txt > output.txt 2> stderr.txt"
+  ./driver --perf-counters < input-$TESTNO.txt > output.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus 0 "$ASTATUS" ||
+     ! checkFile "Program output" "expected-$TESTNO.txt" "output.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+  if ! grep -q "^run \|^perf counters unavailable" stderr.txt; then
+      fail "FAILED - no counter report in stderr.txt"
+      return 1
+  fi
+
+  echo "Counters test $TESTNO PASS"
+  return 0
+}
+
+# Run a test that saves the map, then check the dump file it wrote, and
+# that replaying the dump rebuilds a map that saves the same way.
+runSaveTest() {
+  TESTNO=$1
+
+  rm -f dump-$TESTNO.txt replay-$TESTNO.txt
+  if ! runTest $TESTNO; then
+      return 1
+  fi
+
+  echo "   ./driver --batch < dump-$TESTNO.txt"
+  ( cat dump-$TESTNO.txt; echo "save replay-$TESTNO.txt" ) | ./driver --batch > output.txt 2> stderr.txt
+  if ! checkFile "Dump file" "expected-dump-$TESTNO.txt" "dump-$TESTNO.txt" ||
+     ! checkFile "Replayed dump file" "expected-dump-$TESTNO.txt" "replay-$TESTNO.txt" ||
+     ! checkEmpty "Stderr output" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+
+  rm -f dump-$TESTNO.txt replay-$TESTNO.txt
+  echo "Save test $TESTNO PASS"
+  return 0
+}
+
 # get a fresh copy of the target program
 make clean
 
@@ -189,6 +325,64 @@ else
 fi
 
 
+# Make the alphabet-specialized map unit test program and run it
+rm -f mapVariantsTest
+make mapVariantsTest
+
+if [ -x mapVariantsTest ]; then
+    if ./mapVariantsTest; then
+	echo "Map variants test program passed"
+    else
+	echo "Map variants test program didn't finish successfully."
+    fi
+else
+    fail "Couldn't build the mapVariantsTest program."
+fi
+
+
+# Make the object pool unit test program and run it
+rm -f poolTest
+make poolTest
+
+if [ -x poolTest ]; then
+    if ./poolTest; then
+	echo "Pool test program passed"
+    else
+	echo "Pool test program didn't finish successfully."
+    fi
+else
+    fail "Couldn't build the poolTest program."
+fi
+
+# Make the ring unit test program and run it
+rm -f ringTest
+make ringTest
+
+if [ -x ringTest ]; then
+    if ./ringTest; then
+	echo "Ring test program passed"
+    else
+	echo "Ring test program didn't finish successfully."
+    fi
+else
+    fail "Couldn't build the ringTest program."
+fi
+
+# Make the performance counter unit test program and run it
+rm -f countersTest
+make countersTest
+
+if [ -x countersTest ]; then
+    if ./countersTest; then
+	echo "Counters test program passed"
+    else
+	echo "Counters test program didn't finish successfully."
+    fi
+else
+    fail "Couldn't build the countersTest program."
+fi
+
+
 make
 if [ $? -ne 0 ]; then
   fail "Make exited unsuccessfully"
@@ -207,6 +401,30 @@ if [ -x driver ]; then
     runTest 09
     runTest 10
     runTest 11
+    runTest 12
+    runSaveTest 13
+    runTest 14
+    runTest 15
+    runTest 16
+    runTest 17
+    runBatchTest 05
+    runBatchTest 09
+    runPipelineTest 05
+    runPipelineTest 11
+    runPipelineTest 15
+    runParallelTest 05 1
+    runParallelTest 05 3
+    runParallelTest 11 8
+    runParallelTest 12 3
+    runParallelTest 13 3
+    runParallelTest 14 3
+    runParallelTest 15 1
+    runParallelTest 15 3
+    runParallelTest 15 8
+    runParallelTest 16 3
+    runParallelTest 17 3
+    runParallelTest 17 8
+    runCountersTest 05
 else
     fail "Your driver program didn't compile, so it couldn't be tested."
 fi
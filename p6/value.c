@@ -6,14 +6,414 @@ Deals with int, double, and string values
 
 
 #include "value.h"
+#include "pool.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
 
 /** Buffer Size*/
 #define BUFFER_SIZE 2
 
+/** Digit pairs 00 through 99, for converting two digits at a time. */
+static char const DIGIT_PAIRS[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+/** Powers of ten that fit in 64 bits. */
+static uint64_t const POW10[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+  1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+  1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/** Current format for double values. */
+static DoubleFormat doubleFormat = DOUBLE_FIXED;
+
+/** Write the decimal digits of an unsigned value into a buffer, two at a time.
+    @param val value to convert.
+    @param buffer buffer with room for at least 20 characters.
+    @return number of characters written, without a null terminator. */
+static int formatUnsigned( uint64_t val, char *buffer )
+{
+  // Fill a temporary from the right, then copy to the front of buffer.
+  char tmp[ 20 ];
+  int pos = sizeof( tmp );
+  while ( val >= 100 ) {
+    int pair = ( val % 100 ) * 2;
+    val /= 100;
+    tmp[ --pos ] = DIGIT_PAIRS[ pair + 1 ];
+    tmp[ --pos ] = DIGIT_PAIRS[ pair ];
+  }
+  if ( val >= 10 ) {
+    tmp[ --pos ] = DIGIT_PAIRS[ val * 2 + 1 ];
+    tmp[ --pos ] = DIGIT_PAIRS[ val * 2 ];
+  } else
+    tmp[ --pos ] = '0' + val;
+
+  int len = sizeof( tmp ) - pos;
+  memcpy( buffer, tmp + pos, len );
+  return len;
+}
+
+int formatLong( long val, char *buffer )
+{
+  int len = 0;
+  uint64_t mag = val;
+  if ( val < 0 ) {
+    buffer[ len++ ] = '-';
+    mag = -mag;
+  }
+  len += formatUnsigned( mag, buffer + len );
+  buffer[ len ] = '\0';
+  return len;
+}
+
+int formatInteger( int val, char *buffer )
+{
+  return formatLong( val, buffer );
+}
+
+/** Format a double exactly the way printf's %f does: the exact binary value
+    rounded half-to-even to six decimal places.  The integer part and the
+    fraction are worked out separately, with the fraction scaled by 10^6 in
+    128-bit arithmetic, so no step rounds early.  Values of 2^64 or more and
+    non-finite values are left to snprintf.
+    @param val value to convert.
+    @param buffer buffer with room for DOUBLE_LENGTH + 1 characters.
+    @return number of characters written, not counting the null terminator. */
+static int formatFixed( double val, char *buffer )
+{
+#ifdef __SIZEOF_INT128__
+  uint64_t bits;
+  memcpy( &bits, &val, sizeof( bits ) );
+  int biased = ( bits >> 52 ) & 0x7FF;
+  uint64_t f = bits & 0xFFFFFFFFFFFFFULL;
+  if ( biased != 0x7FF ) {
+    // val is f * 2^e, with f below 2^53.
+    int e = biased == 0 ? -1074 : biased - 1075;
+    if ( biased != 0 )
+      f |= 1ULL << 52;
+
+    uint64_t ip = 0, q = 0;
+    bool fits = true;
+    if ( e >= 0 ) {
+      fits = e <= 11;
+      ip = f << ( fits ? e : 0 );
+    } else {
+      int k = -e;
+      uint64_t fr = f;
+      if ( k < 64 ) {
+        ip = f >> k;
+        fr = f - ( ip << k );
+      }
+
+      // Once k reaches 128, fr * 10^6 (under 2^73) is far below half of 2^k,
+      // so the fraction rounds to zero.
+      if ( k < 128 && fr != 0 ) {
+        unsigned __int128 num = (unsigned __int128) fr * 1000000;
+        unsigned __int128 half = (unsigned __int128) 1 << ( k - 1 );
+        unsigned __int128 rem = num & ( ( half << 1 ) - 1 );
+        q = num >> k;
+        if ( rem > half || ( rem == half && ( q & 1 ) ) )
+          q++;
+        if ( q == 1000000 ) {
+          q = 0;
+          ip++;
+        }
+      }
+    }
+
+    if ( fits ) {
+      int len = 0;
+      if ( bits >> 63 )
+        buffer[ len++ ] = '-';
+      len += formatUnsigned( ip, buffer + len );
+      buffer[ len++ ] = '.';
+      for ( int i = 5; i >= 0; i-- ) {
+        buffer[ len + i ] = '0' + q % 10;
+        q /= 10;
+      }
+      len += 6;
+      buffer[ len ] = '\0';
+      return len;
+    }
+  }
+#endif
+  return snprintf( buffer, DOUBLE_LENGTH + 1, "%f", val );
+}
+
+/** Extended-precision floating point value, f * 2^e, used by Grisu. */
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+/** Normalized 64-bit significands of the cached powers of ten
+    10^-348, 10^-340, ..., 10^340, rounded to nearest. */
+static uint64_t const CACHED_POWER_F[] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+  0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+  0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+  0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+  0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+  0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+  0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+  0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+  0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+  0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+  0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+  0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+  0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+  0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+  0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+  0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+  0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+  0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+  0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+  0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+  0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+  0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+/** Binary exponents matching CACHED_POWER_F. */
+static short const CACHED_POWER_E[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+/** Multiply two DiyFp values, keeping the rounded upper 64 bits.
+    @param x first factor.
+    @param y second factor.
+    @return the product. */
+static DiyFp diyMultiply( DiyFp x, DiyFp y )
+{
+  uint64_t const M32 = 0xFFFFFFFFULL;
+  uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = ( bd >> 32 ) + ( ad & M32 ) + ( bc & M32 ) + ( 1ULL << 31 );
+  DiyFp r = { ac + ( ad >> 32 ) + ( bc >> 32 ) + ( tmp >> 32 ), x.e + y.e + 64 };
+  return r;
+}
+
+/** Shift a DiyFp left until its top bit is set.
+    @param x value to normalize, which can't be zero.
+    @return the normalized value. */
+static DiyFp diyNormalize( DiyFp x )
+{
+  int shift = __builtin_clzll( x.f );
+  DiyFp r = { x.f << shift, x.e - shift };
+  return r;
+}
+
+/** Nudge the last generated digit down while that brings the digits closer to
+    the exact value and keeps them inside the rounding interval.
+    @param buffer the digits generated so far.
+    @param len number of digits in buffer.
+    @param delta width of the rounding interval.
+    @param rest distance from the digits to the top of the interval.
+    @param tenKappa value of one unit in the last digit.
+    @param wpw distance from the exact value to the top of the interval. */
+static void grisuRound( char *buffer, int len, uint64_t delta, uint64_t rest,
+                        uint64_t tenKappa, uint64_t wpw )
+{
+  while ( rest < wpw && delta - rest >= tenKappa &&
+          ( rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw ) ) {
+    buffer[ len - 1 ]--;
+    rest += tenKappa;
+  }
+}
+
+/** Generate the shortest digits for a positive, finite double with Grisu2.
+    @param val value to convert.
+    @param buffer receives the digits, at least 18 characters.
+    @param k receives the decimal exponent, so val is digits * 10^k.
+    @return number of digits generated. */
+static int grisu2( double val, char *buffer, int *k )
+{
+  uint64_t bits;
+  memcpy( &bits, &val, sizeof( bits ) );
+  int biased = ( bits >> 52 ) & 0x7FF;
+  DiyFp v = { bits & 0xFFFFFFFFFFFFFULL, biased == 0 ? -1074 : biased - 1075 };
+  if ( biased != 0 )
+    v.f |= 1ULL << 52;
+
+  // Boundaries halfway to the neighboring doubles.
+  DiyFp plus = { ( v.f << 1 ) + 1, v.e - 1 };
+  plus = diyNormalize( plus );
+  DiyFp minus = v.f == ( 1ULL << 52 ) ? (DiyFp){ ( v.f << 2 ) - 1, v.e - 2 }
+                                      : (DiyFp){ ( v.f << 1 ) - 1, v.e - 1 };
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  // Pick a cached power of ten that brings the exponent into range.
+  double dk = ( -61 - plus.e ) * 0.30102999566398114 + 347;
+  int ik = (int) dk;
+  if ( dk - ik > 0.0 )
+    ik++;
+  int index = ( ik >> 3 ) + 1;
+  *k = -( -348 + index * 8 );
+  DiyFp c = { CACHED_POWER_F[ index ], CACHED_POWER_E[ index ] };
+
+  DiyFp w = diyMultiply( diyNormalize( v ), c );
+  DiyFp wp = diyMultiply( plus, c );
+  DiyFp wm = diyMultiply( minus, c );
+  wm.f++;
+  wp.f--;
+
+  // Generate digits of wp until they're inside the interval (wm, wp).
+  uint64_t delta = wp.f - wm.f;
+  DiyFp one = { 1ULL << -wp.e, wp.e };
+  uint64_t wpw = wp.f - w.f;
+  uint32_t p1 = wp.f >> -one.e;
+  uint64_t p2 = wp.f & ( one.f - 1 );
+  int kappa = 1;
+  while ( kappa < 10 && p1 >= POW10[ kappa ] )
+    kappa++;
+
+  int len = 0;
+  while ( kappa > 0 ) {
+    uint32_t d = p1 / POW10[ kappa - 1 ];
+    p1 %= POW10[ kappa - 1 ];
+    if ( d || len )
+      buffer[ len++ ] = '0' + d;
+    kappa--;
+    uint64_t rest = ( (uint64_t) p1 << -one.e ) + p2;
+    if ( rest <= delta ) {
+      *k += kappa;
+      grisuRound( buffer, len, delta, rest, POW10[ kappa ] << -one.e, wpw );
+      return len;
+    }
+  }
+  for ( ;; ) {
+    p2 *= 10;
+    delta *= 10;
+    char d = p2 >> -one.e;
+    if ( d || len )
+      buffer[ len++ ] = '0' + d;
+    p2 &= one.f - 1;
+    kappa--;
+    if ( p2 < delta ) {
+      *k += kappa;
+      grisuRound( buffer, len, delta, p2, one.f,
+                  -kappa < 20 ? wpw * POW10[ -kappa ] : 0 );
+      return len;
+    }
+  }
+}
+
+/** Format a double with the fewest digits that still read back as exactly
+    the same value.  The result always has a decimal point or an exponent, so
+    it can't be mistaken for an integer.
+    @param val value to convert.
+    @param buffer buffer with room for DOUBLE_LENGTH + 1 characters.
+    @return number of characters written, not counting the null terminator. */
+static int formatShortest( double val, char *buffer )
+{
+  uint64_t bits;
+  memcpy( &bits, &val, sizeof( bits ) );
+  if ( ( ( bits >> 52 ) & 0x7FF ) == 0x7FF )
+    return snprintf( buffer, DOUBLE_LENGTH + 1, "%f", val );
+
+  int len = 0;
+  if ( bits >> 63 )
+    buffer[ len++ ] = '-';
+  if ( ( bits << 1 ) == 0 ) {
+    strcpy( buffer + len, "0.0" );
+    return len + 3;
+  }
+
+  char digits[ 18 ];
+  int k;
+  int n = grisu2( bits >> 63 ? -val : val, digits, &k );
+
+  // Position of the decimal point relative to the start of the digits.
+  int point = n + k;
+  if ( point > 0 && point <= 17 ) {
+    if ( point >= n ) {
+      memcpy( buffer + len, digits, n );
+      len += n;
+      memset( buffer + len, '0', point - n );
+      len += point - n;
+      memcpy( buffer + len, ".0", 2 );
+      len += 2;
+    } else {
+      memcpy( buffer + len, digits, point );
+      len += point;
+      buffer[ len++ ] = '.';
+      memcpy( buffer + len, digits + point, n - point );
+      len += n - point;
+    }
+  } else if ( point <= 0 && point > -4 ) {
+    memcpy( buffer + len, "0.", 2 );
+    len += 2;
+    memset( buffer + len, '0', -point );
+    len += -point;
+    memcpy( buffer + len, digits, n );
+    len += n;
+  } else {
+    // Scientific notation, like printf's %e.
+    buffer[ len++ ] = digits[ 0 ];
+    if ( n > 1 ) {
+      buffer[ len++ ] = '.';
+      memcpy( buffer + len, digits + 1, n - 1 );
+      len += n - 1;
+    }
+    int exp = point - 1;
+    buffer[ len++ ] = 'e';
+    buffer[ len++ ] = exp < 0 ? '-' : '+';
+    if ( exp < 0 )
+      exp = -exp;
+    if ( exp < 10 )
+      buffer[ len++ ] = '0';
+    len += formatUnsigned( exp, buffer + len );
+  }
+  buffer[ len ] = '\0';
+  return len;
+}
+
+int formatDouble( double val, char *buffer )
+{
+  return formatDoubleAs( val, doubleFormat, buffer );
+}
+
+int formatDoubleAs( double val, DoubleFormat format, char *buffer )
+{
+  if ( format == DOUBLE_SHORTEST )
+    return formatShortest( val, buffer );
+  return formatFixed( val, buffer );
+}
+
+void setDoubleFormat( DoubleFormat format )
+{
+  doubleFormat = format;
+}
+
+DoubleFormat getDoubleFormat()
+{
+  return doubleFormat;
+}
+
 /** Type used to represent a subclass of Value that holds an integer. */
 typedef struct {
   // Superclass fields.
@@ -25,8 +425,8 @@ typedef struct {
   int val;
 } IntegerValue;
 
-/** Maximum length of a 32-bit integer as a string. */
-#define INTEGER_LENGTH 11
+/** Pool of integer values. */
+static Pool integerPool = POOL_INITIALIZER( "integer", IntegerValue );
 
 // toString method for integers
 static char *integerToString( Value const *v )
@@ -36,7 +436,7 @@ static char *integerToString( Value const *v )
 
   // Convert to a dynamically allocated string.
   char *str = (char *) malloc( INTEGER_LENGTH + 1 );
-  sprintf( str, "%d", this->val );
+  formatInteger( this->val, str );
   return str;
 }
 
@@ -60,8 +460,8 @@ static bool integerPlus( Value *v, Value const *x )
 // destroy method for integers
 static void integerDestroy( Value *v )
 {
-  // All the memory for an integer is in one big block.
-  free( v );
+  // All the memory for an integer is in one block from the pool.
+  poolFree( &integerPool, v );
 }
 
 Value *parseInteger( char const *str )
@@ -75,7 +475,7 @@ Value *parseInteger( char const *str )
     return NULL;
 
   // Make a new instance of an integer value.
-  IntegerValue *v = (IntegerValue *) malloc( sizeof( IntegerValue ) );
+  IntegerValue *v = (IntegerValue *) poolAlloc( &integerPool );
   v->toString = integerToString;
   v->plus = integerPlus;
   v->destroy = integerDestroy;
@@ -103,10 +503,9 @@ typedef struct {
   double val;
 } DoubleValue;
 
+/** Pool of double values. */
+static Pool doublePool = POOL_INITIALIZER( "double", DoubleValue );
 
-/** This is the maximum number of characters I could get from a double value,
-    printed with %f. */
-#define DOUBLE_LENGTH 317
 
 // toString method for doubles
 /**
@@ -119,9 +518,11 @@ static char *doubleToString( Value const *v )
   // Get v as a pointer to the subclass struct.
   DoubleValue *this = (DoubleValue *) v;
 
-  // Convert to a dynamically allocated string.
-  char *str = (char *) malloc( DOUBLE_LENGTH + 1 );
-  sprintf( str, "%f", this->val );
+  // Format into a local buffer, then copy out just the characters we need.
+  char buffer[ DOUBLE_LENGTH + 1 ];
+  int len = formatDouble( this->val, buffer );
+  char *str = (char *) malloc( len + 1 );
+  memcpy( str, buffer, len + 1 );
   return str;
 }
 
@@ -155,8 +556,8 @@ Frees all memmory for DoubleValue
 */
 static void doubleDestroy( Value *v )
 {
-  // All the memory for an double is in one big block.
-  free( v );
+  // All the memory for an double is in one block from the pool.
+  poolFree( &doublePool, v );
 }
 
 /**
@@ -175,7 +576,7 @@ Value *parseDouble( char const *str )
     return NULL;
 
   // Make a new instance of an integer value.
-  DoubleValue *v = (DoubleValue *) malloc( sizeof( DoubleValue ) );
+  DoubleValue *v = (DoubleValue *) poolAlloc( &doublePool );
   v->toString = doubleToString;
   v->plus = doublePlus;
   v->destroy = doubleDestroy;
@@ -200,8 +601,172 @@ typedef struct {
 
   // Subclass fields.
   char *val;
+
+  /** Shared entry holding the characters if the string is interned,
+      otherwise NULL and val is owned by this value. */
+  struct InternEntryStruct *interned;
 } StringValue;
 
+/** Pool of string value structs.  The characters are allocated separately. */
+static Pool stringPool = POOL_INITIALIZER( "string", StringValue );
+
+/** Number of buckets the intern table starts with. */
+#define INITIAL_INTERN_BUCKETS 64
+
+/** Characters of an interned string, shared by all the values with the same
+    text. */
+typedef struct InternEntryStruct {
+  /** Next entry in the same bucket. */
+  struct InternEntryStruct *next;
+
+  /** Hash of the text. */
+  unsigned hash;
+
+  /** Number of string values using this entry. */
+  long refs;
+
+  /** Length of the text. */
+  int len;
+
+  /** The text, including its quotes. */
+  char text[];
+} InternEntry;
+
+/** True if parseString() should intern the strings it makes. */
+static bool interning = false;
+
+/** Hash table of interned strings. */
+static InternEntry **internTable;
+
+/** Number of buckets in the intern table, always a power of two. */
+static int internBuckets;
+
+/** Number of entries in the intern table. */
+static long internEntries;
+
+/** Number of string values using the entries. */
+static long internRefs;
+
+/** Total length of the text of all the values using the entries. */
+static long internChars;
+
+/** Memory used for the text of the entries, including null terminators. */
+static long internTextBytes;
+
+/** Lock for the intern table and its counts. */
+static pthread_mutex_t internLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+Hashes a string with FNV-1a
+@param str the string
+@param len length of the string
+@return the hash
+*/
+static unsigned hashString( char const *str, int len )
+{
+  unsigned h = 2166136261u;
+  for ( int i = 0; i < len; i++ )
+    h = ( h ^ (unsigned char) str[ i ] ) * 16777619u;
+  return h;
+}
+
+/**
+Doubles the number of buckets in the intern table.  Must be called with the
+table locked.
+*/
+static void growInternTable()
+{
+  int buckets = internBuckets * 2;
+  InternEntry **table = (InternEntry **) calloc( buckets, sizeof( InternEntry * ) );
+  for ( int i = 0; i < internBuckets; i++ ) {
+    InternEntry *e = internTable[ i ];
+    while ( e ) {
+      InternEntry *next = e->next;
+      e->next = table[ e->hash & ( buckets - 1 ) ];
+      table[ e->hash & ( buckets - 1 ) ] = e;
+      e = next;
+    }
+  }
+  free( internTable );
+  internTable = table;
+  internBuckets = buckets;
+}
+
+/**
+Finds or adds the intern table entry for the given text, adding a reference
+to it
+@param text the text, including its quotes
+@return the entry
+*/
+static InternEntry *intern( char const *text )
+{
+  int len = strlen( text );
+  unsigned h = hashString( text, len );
+  pthread_mutex_lock( &internLock );
+  if ( internTable == NULL ) {
+    internBuckets = INITIAL_INTERN_BUCKETS;
+    internTable = (InternEntry **) calloc( internBuckets, sizeof( InternEntry * ) );
+  }
+
+  InternEntry **bucket = &internTable[ h & ( internBuckets - 1 ) ];
+  InternEntry *e = *bucket;
+  while ( e && ( e->hash != h || e->len != len || memcmp( e->text, text, len ) != 0 ) )
+    e = e->next;
+  if ( e == NULL ) {
+    e = (InternEntry *) malloc( sizeof( InternEntry ) + len + 1 );
+    e->hash = h;
+    e->refs = 0;
+    e->len = len;
+    memcpy( e->text, text, len + 1 );
+    e->next = *bucket;
+    *bucket = e;
+    internEntries++;
+    internTextBytes += len + 1;
+    if ( internEntries > internBuckets )
+      growInternTable();
+  }
+  e->refs++;
+  internRefs++;
+  internChars += len;
+  pthread_mutex_unlock( &internLock );
+  return e;
+}
+
+/**
+Adds a reference to an intern table entry, for a copy of a value using it
+@param e the entry
+*/
+static void retainInterned( InternEntry *e )
+{
+  pthread_mutex_lock( &internLock );
+  e->refs++;
+  internRefs++;
+  internChars += e->len;
+  pthread_mutex_unlock( &internLock );
+}
+
+/**
+Drops a reference to an intern table entry, removing it from the table and
+freeing it when the last value using it goes away
+@param e the entry
+*/
+static void releaseInterned( InternEntry *e )
+{
+  pthread_mutex_lock( &internLock );
+  internRefs--;
+  internChars -= e->len;
+  if ( --e->refs == 0 ) {
+    InternEntry **link = &internTable[ e->hash & ( internBuckets - 1 ) ];
+    while ( *link != e )
+      link = &( *link )->next;
+    *link = e->next;
+    internEntries--;
+    internTextBytes -= e->len + 1;
+    free( e );
+  }
+  pthread_mutex_unlock( &internLock );
+}
+
 // toString method for string
 /**
 Convert val field into a C string
@@ -237,6 +802,14 @@ static bool stringPlus( Value *v, Value const *x )
   StringValue *this = (StringValue *) v;
   StringValue *that = (StringValue *) x;
 
+  // An interned string is shared, so get a private copy before changing it.
+  if ( this->interned ) {
+    this->val = (char *) malloc( this->interned->len + 1 );
+    strcpy( this->val, this->interned->text );
+    releaseInterned( this->interned );
+    this->interned = NULL;
+  }
+
   // Add the value in x to v.
   this->val[strlen(this->val) - 1] = '\0';
   this->val = (char *)realloc( this->val, (strlen(this->val) + strlen(that->val) + 1) * sizeof( char ) );
@@ -251,8 +824,12 @@ Frees all memmory for StringValue
 */
 static void stringDestroy( Value *v )
 {
-  free(((StringValue *) v)->val);
-  free( v );
+  StringValue *this = (StringValue *) v;
+  if ( this->interned )
+    releaseInterned( this->interned );
+  else
+    free( this->val );
+  poolFree( &stringPool, v );
 }
 
 /**
@@ -280,15 +857,145 @@ Value *parseString( char const *str )
 
   sval[strlen(sval)] = '\0';
   if (sval[0] != '\"' || sval[strlen(sval) - 1] != '\"') {
+    free(sval);
     return NULL;
   }
   // Make a new instance of an integer value.
-  StringValue *v = (StringValue *) malloc( sizeof( StringValue ) );
+  StringValue *v = (StringValue *) poolAlloc( &stringPool );
   v->toString = stringToString;
   v->plus = stringPlus;
   v->destroy = stringDestroy;
   v->val = sval;
+  v->interned = NULL;
+  if ( interning ) {
+    v->interned = intern( sval );
+    v->val = v->interned->text;
+    free( sval );
+  }
 
   // Return as a pointer to the superclass.
   return (Value *)v;
 }
+
+/**
+Make a dynamically allocated, independent copy of the given value.  The copy has
+the same type and contents as the original, so either one can be modified or
+destroyed without affecting the other.
+@param v the value to copy
+@return the new copy of v
+*/
+Value *copyValue( Value const *v )
+{
+  // Like the plus methods, use the toString pointer to tell what subclass v is.
+  if ( v->toString == integerToString ) {
+    IntegerValue *copy = (IntegerValue *) poolAlloc( &integerPool );
+    *copy = *(IntegerValue *) v;
+    return (Value *)copy;
+  }
+
+  if ( v->toString == doubleToString ) {
+    DoubleValue *copy = (DoubleValue *) poolAlloc( &doublePool );
+    *copy = *(DoubleValue *) v;
+    return (Value *)copy;
+  }
+
+  // Strings also need their own copy of the characters, unless they're
+  // interned and can share them.
+  StringValue *this = (StringValue *) v;
+  StringValue *copy = (StringValue *) poolAlloc( &stringPool );
+  *copy = *this;
+  if ( this->interned ) {
+    retainInterned( this->interned );
+    return (Value *)copy;
+  }
+  copy->val = (char *) malloc( strlen( this->val ) + 1 );
+  strcpy( copy->val, this->val );
+  return (Value *)copy;
+}
+
+/**
+Report how many bytes of dynamically allocated memory the given value is using,
+including its own struct and any memory it points to.
+@param v the value to measure
+@return number of bytes used by v
+*/
+size_t valueBytes( Value const *v )
+{
+  if ( v->toString == integerToString )
+    return sizeof( IntegerValue );
+
+  if ( v->toString == doubleToString )
+    return sizeof( DoubleValue );
+
+  // The characters of an interned string belong to the intern table.
+  if ( ((StringValue *) v)->interned )
+    return sizeof( StringValue );
+
+  return sizeof( StringValue ) + strlen( ((StringValue *) v)->val ) + 1;
+}
+
+/**
+Get the number held by an integer value
+@param v the value
+@param x returns the value's integer, if it has one
+@return true if v is an integer value
+*/
+bool integerValue( Value const *v, int *x )
+{
+  if ( v->toString != integerToString )
+    return false;
+  *x = ((IntegerValue *) v)->val;
+  return true;
+}
+
+/**
+Get the number held by a double value
+@param v the value
+@param x returns the value's double, if it has one
+@return true if v is a double value
+*/
+bool doubleValue( Value const *v, double *x )
+{
+  if ( v->toString != doubleToString )
+    return false;
+  *x = ((DoubleValue *) v)->val;
+  return true;
+}
+
+/**
+Choose whether parseString() interns the strings it makes, so values with
+the same text share one copy of the characters
+@param on true to intern new strings
+*/
+void setStringInterning( bool on )
+{
+  interning = on;
+}
+
+/**
+Report how well interning is deduplicating strings
+@param stats filled in with the intern table's counts
+*/
+void internStats( InternStats *stats )
+{
+  pthread_mutex_lock( &internLock );
+  stats->strings = internEntries;
+  stats->values = internRefs;
+  stats->bytes = internEntries * sizeof( InternEntry ) + internTextBytes;
+
+  // Without interning, every value would have its own copy of its text.
+  stats->savedBytes = internChars + internRefs - stats->bytes;
+  pthread_mutex_unlock( &internLock );
+}
+
+/**
+Report the occupancy of the pools that values are allocated from, one entry
+each for integers, doubles and strings
+@param stats array filled in with the stats for each pool
+*/
+void valuePoolStats( PoolStats stats[ VALUE_POOLS ] )
+{
+  poolStats( &integerPool, &stats[ 0 ] );
+  poolStats( &doublePool, &stats[ 1 ] );
+  poolStats( &stringPool, &stats[ 2 ] );
+}
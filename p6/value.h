@@ -8,6 +8,27 @@ Deals with int, double, and string values
 #define VALUE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include "pool.h"
+
+/** Maximum length of a 32-bit integer as a string. */
+#define INTEGER_LENGTH 11
+
+/** Maximum length of a 64-bit integer as a string. */
+#define LONG_LENGTH 20
+
+/** This is the maximum number of characters I could get from a double value,
+    printed with %f. */
+#define DOUBLE_LENGTH 317
+
+/** Ways double values can be converted to strings. */
+typedef enum {
+  /** Six digits after the decimal point, exactly like printf's %f. */
+  DOUBLE_FIXED,
+
+  /** The fewest digits that convert back to the same double. */
+  DOUBLE_SHORTEST
+} DoubleFormat;
 
 /** Give a short name to the Value struct defined below. */
 typedef struct ValueStruct Value;
@@ -52,4 +73,116 @@ Parse the given string as a string and create a dynamically allocated instance o
 */
 Value *parseString( char const *str );
 
+/** Write an integer into a buffer in decimal, the same as printf's %d.
+    @param val value to convert.
+    @param buffer buffer with room for INTEGER_LENGTH + 1 characters.
+    @return number of characters written, not counting the null terminator. */
+int formatInteger( int val, char *buffer );
+
+/** Write a long integer into a buffer in decimal, the same as printf's %ld.
+    @param val value to convert.
+    @param buffer buffer with room for LONG_LENGTH + 1 characters.
+    @return number of characters written, not counting the null terminator. */
+int formatLong( long val, char *buffer );
+
+/** Write a double into a buffer, using the current double format.
+    @param val value to convert.
+    @param buffer buffer with room for DOUBLE_LENGTH + 1 characters.
+    @return number of characters written, not counting the null terminator. */
+int formatDouble( double val, char *buffer );
+
+/** Write a double into a buffer in the given format, whatever the
+    current format is.
+    @param val value to convert.
+    @param format format to use.
+    @param buffer buffer with room for DOUBLE_LENGTH + 1 characters.
+    @return number of characters written, not counting the null terminator. */
+int formatDoubleAs( double val, DoubleFormat format, char *buffer );
+
+/** Choose how double values are converted to strings, by toString and
+    formatDouble().  The default is DOUBLE_FIXED.
+    @param format the new format for doubles. */
+void setDoubleFormat( DoubleFormat format );
+
+/** Get the format currently used for doubles.
+    @return the format set by setDoubleFormat(). */
+DoubleFormat getDoubleFormat();
+
+/**
+Make a dynamically allocated, independent copy of the given value.  The copy has
+the same type and contents as the original, so either one can be modified or
+destroyed without affecting the other.
+@param v the value to copy
+@return the new copy of v
+*/
+Value *copyValue( Value const *v );
+
+/**
+Report how many bytes of dynamically allocated memory the given value is using,
+including its own struct and any memory it points to.
+@param v the value to measure
+@return number of bytes used by v
+*/
+size_t valueBytes( Value const *v );
+
+/**
+Get the number held by an integer value
+@param v the value
+@param x returns the value's integer, if it has one
+@return true if v is an integer value
+*/
+bool integerValue( Value const *v, int *x );
+
+/**
+Get the number held by a double value
+@param v the value
+@param x returns the value's double, if it has one
+@return true if v is a double value
+*/
+bool doubleValue( Value const *v, double *x );
+
+/** How much interning has deduplicated string values. */
+typedef struct {
+  /** Number of distinct strings in the intern table. */
+  long strings;
+
+  /** Number of string values sharing those strings.  Divided by strings,
+      this is the dedup ratio. */
+  long values;
+
+  /** Memory used by the intern table's entries. */
+  long bytes;
+
+  /** Memory the values would use for their characters if each had its own
+      copy, minus bytes. */
+  long savedBytes;
+} InternStats;
+
+/**
+Choose whether parseString() interns the strings it makes.  Interned strings
+with the same text share one reference-counted copy of the characters, which
+is copied before plus changes it.  valueBytes() counts only the value struct
+for an interned string; the shared characters are reported by internStats().
+Interning is off by default.
+@param on true to intern new strings
+*/
+void setStringInterning( bool on );
+
+/**
+Report how well interning is deduplicating strings
+@param stats filled in with the intern table's counts
+*/
+void internStats( InternStats *stats );
+
+/** Number of pools values are allocated from. */
+#define VALUE_POOLS 3
+
+/**
+Report the occupancy of the pools that values are allocated from, one entry
+each for integers, doubles and strings.  Build with -DPOOL_MALLOC to allocate
+values with plain malloc() instead, when checking memory with valgrind.
+@param stats array filled in with the stats for each pool
+*/
+void valuePoolStats( PoolStats stats[ VALUE_POOLS ] );
+
 #endif
@@ -0,0 +1,268 @@
+/**
+@file workload
+@author Ethan Browne, efbrowne
+Generates driver command files for performance testing.  The number of
+commands, the mix of set, get, plus and remove, the key space, key lengths,
+key popularity and value types can all be set on the command line.  The
+commands are written to standard output.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "zipf.h"
+
+/** Characters used in generated keys. */
+static char const KEY_CHARS[] =
+  "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/** Number of characters in KEY_CHARS. */
+#define KEY_BASE ( sizeof( KEY_CHARS ) - 1 )
+
+/** Longest key the generator will make. */
+#define MAX_KEY_LENGTH 1000
+
+/** Words used for string values. */
+static char const *const WORDS[] = {
+  "ok", "error", "pending", "active", "disabled", "queued", "done", "retry"
+};
+
+/** Number of words available for string values. */
+#define WORD_COUNT ( sizeof( WORDS ) / sizeof( WORDS[ 0 ] ) )
+
+/** Kinds of values the generator can use. */
+typedef enum { VALUES_INT, VALUES_DOUBLE, VALUES_STRING, VALUES_MIXED } ValueKind;
+
+/** Settings for the generated workload. */
+typedef struct {
+  /** Number of commands to generate. */
+  long lines;
+
+  /** Number of distinct keys. */
+  int keys;
+
+  /** Relative weights of set, get, plus and remove. */
+  int mix[ 4 ];
+
+  /** Range of key lengths. */
+  int minLength, maxLength;
+
+  /** True for Zipf key popularity, false for uniform. */
+  bool zipf;
+
+  /** Exponent for Zipf popularity. */
+  double zipfS;
+
+  /** Types of values to use in set and plus. */
+  ValueKind values;
+
+  /** Seed for the random number generator. */
+  uint64_t seed;
+
+  /** If nonzero, every this many lines is a size command. */
+  long sizeEvery;
+} Settings;
+
+/** State of the random number generator. */
+static uint64_t rngState;
+
+/**
+Returns the next number from a xorshift64* generator
+@return a random 64-bit number
+*/
+static uint64_t nextRandom()
+{
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+Returns a uniform random number in [0, 1)
+@return the number
+*/
+static double nextUniform()
+{
+  return ( nextRandom() >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+/**
+Mixes the bits of a number, to get a repeatable pseudo-random value from it
+@param x the number
+@return the mixed bits
+*/
+static uint64_t mix( uint64_t x )
+{
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+/**
+Writes the key for a rank.  The key starts with the rank in a fixed number of
+base-62 digits, so keys are distinct, and is padded out to a length picked
+from the rank, so the same rank always gives the same key.
+@param s the settings
+@param rank the key's rank
+@param width number of digits used for the rank
+@param key buffer for the key
+*/
+static void makeKey( Settings const *s, int rank, int width, char *key )
+{
+  uint64_t h = mix( rank + s->seed );
+  int len = s->minLength + h % ( s->maxLength - s->minLength + 1 );
+  if ( len < width )
+    len = width;
+  int r = rank;
+  for ( int i = width - 1; i >= 0; i-- ) {
+    key[ i ] = KEY_CHARS[ r % KEY_BASE ];
+    r /= KEY_BASE;
+  }
+  for ( int i = width; i < len; i++ ) {
+    h = mix( h + i );
+    key[ i ] = KEY_CHARS[ h % KEY_BASE ];
+  }
+  key[ len ] = '\0';
+}
+
+/**
+Writes a random value for a key.  With mixed values, each key always gets the
+same type, so plus commands usually add compatible values.
+@param s the settings
+@param rank the key's rank
+*/
+static void printValue( Settings const *s, int rank )
+{
+  ValueKind kind = s->values;
+  if ( kind == VALUES_MIXED )
+    kind = mix( rank ) % 3;
+  switch ( kind ) {
+  case VALUES_INT:
+    printf( "%d", (int) ( nextRandom() % 2001 ) - 1000 );
+    break;
+  case VALUES_DOUBLE:
+    printf( "%.3f", nextUniform() * 2000 - 1000 );
+    break;
+  default:
+    printf( "\"%s\"", WORDS[ nextRandom() % WORD_COUNT ] );
+  }
+}
+
+/**
+Prints a usage message and exits unsuccessfully
+*/
+static void usage()
+{
+  fprintf( stderr, "usage: workload [--lines n] [--keys n] [--mix set:get:plus:remove]\n"
+           "                [--key-length min:max] [--dist uniform|zipf] [--zipf-s s]\n"
+           "                [--values int|double|string|mixed] [--seed n] [--size-every n]\n" );
+  exit( EXIT_FAILURE );
+}
+
+/**
+Parses the command-line options into settings
+@param argc number of command-line arguments
+@param argv the command-line arguments
+@param s the settings, already holding the defaults
+*/
+static void parseOptions( int argc, char *argv[], Settings *s )
+{
+  for ( int i = 1; i < argc; i++ ) {
+    if ( i + 1 >= argc )
+      usage();
+    char const *opt = argv[ i ];
+    char const *arg = argv[ ++i ];
+    bool ok = true;
+    if ( strcmp( opt, "--lines" ) == 0 )
+      ok = sscanf( arg, "%ld", &s->lines ) == 1 && s->lines >= 0;
+    else if ( strcmp( opt, "--keys" ) == 0 )
+      ok = sscanf( arg, "%d", &s->keys ) == 1 && s->keys > 0;
+    else if ( strcmp( opt, "--mix" ) == 0 )
+      ok = sscanf( arg, "%d:%d:%d:%d", &s->mix[ 0 ], &s->mix[ 1 ], &s->mix[ 2 ],
+                   &s->mix[ 3 ] ) == 4 &&
+        s->mix[ 0 ] >= 0 && s->mix[ 1 ] >= 0 && s->mix[ 2 ] >= 0 && s->mix[ 3 ] >= 0 &&
+        s->mix[ 0 ] + s->mix[ 1 ] + s->mix[ 2 ] + s->mix[ 3 ] > 0;
+    else if ( strcmp( opt, "--key-length" ) == 0 )
+      ok = sscanf( arg, "%d:%d", &s->minLength, &s->maxLength ) == 2 &&
+        s->minLength > 0 && s->minLength <= s->maxLength && s->maxLength <= MAX_KEY_LENGTH;
+    else if ( strcmp( opt, "--dist" ) == 0 ) {
+      ok = strcmp( arg, "uniform" ) == 0 || strcmp( arg, "zipf" ) == 0;
+      s->zipf = strcmp( arg, "zipf" ) == 0;
+    } else if ( strcmp( opt, "--zipf-s" ) == 0 )
+      ok = sscanf( arg, "%lf", &s->zipfS ) == 1 && s->zipfS > 0;
+    else if ( strcmp( opt, "--values" ) == 0 ) {
+      char const *names[] = { "int", "double", "string", "mixed" };
+      ok = false;
+      for ( int v = 0; v < 4; v++ )
+        if ( strcmp( arg, names[ v ] ) == 0 ) {
+          s->values = v;
+          ok = true;
+        }
+    } else if ( strcmp( opt, "--seed" ) == 0 )
+      ok = sscanf( arg, "%lu", (unsigned long *) &s->seed ) == 1;
+    else if ( strcmp( opt, "--size-every" ) == 0 )
+      ok = sscanf( arg, "%ld", &s->sizeEvery ) == 1 && s->sizeEvery >= 0;
+    else
+      ok = false;
+    if ( !ok )
+      usage();
+  }
+}
+
+/**
+Generates the workload described by the command-line options
+@param argc number of command-line arguments
+@param argv the command-line arguments
+@return exit status of the program
+*/
+int main( int argc, char *argv[] )
+{
+  Settings s = { 1000000, 100000, { 40, 40, 10, 10 }, 8, 16, false, 0.99,
+                 VALUES_INT, 1, 0 };
+  parseOptions( argc, argv, &s );
+  rngState = mix( s.seed ) | 1;
+
+  // Enough base-62 digits to give every rank its own key.
+  int width = 1;
+  for ( long n = KEY_BASE; n < s.keys; n *= KEY_BASE )
+    width++;
+
+  Zipf z = { NULL, 0 };
+  if ( s.zipf )
+    z = makeZipf( s.keys, s.zipfS );
+
+  int total = s.mix[ 0 ] + s.mix[ 1 ] + s.mix[ 2 ] + s.mix[ 3 ];
+  char key[ MAX_KEY_LENGTH + 1 ];
+  for ( long i = 0; i < s.lines; i++ ) {
+    if ( s.sizeEvery > 0 && i % s.sizeEvery == s.sizeEvery - 1 ) {
+      printf( "size\n" );
+      continue;
+    }
+    int rank = s.zipf ? nextZipf( &z, nextUniform() ) : nextRandom() % s.keys;
+    makeKey( &s, rank, width, key );
+    int op = nextRandom() % total;
+    if ( op < s.mix[ 0 ] ) {
+      printf( "set %s ", key );
+      printValue( &s, rank );
+    } else if ( op < s.mix[ 0 ] + s.mix[ 1 ] )
+      printf( "get %s", key );
+    else if ( op < s.mix[ 0 ] + s.mix[ 1 ] + s.mix[ 2 ] ) {
+      printf( "plus %s ", key );
+      printValue( &s, rank );
+    } else
+      printf( "remove %s", key );
+    printf( "\n" );
+  }
+  printf( "size\n" );
+
+  if ( s.zipf )
+    freeZipf( &z );
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,58 @@
+/**
+@file zipf
+@author Ethan Browne, efbrowne
+Zipf-distributed random ranks, drawn by binary search over the cumulative
+distribution.
+*/
+
+#include "zipf.h"
+#include <stdlib.h>
+#include <math.h>
+
+/**
+Build a Zipf distribution over ranks 0 .. n - 1
+@param n number of ranks
+@param s the exponent, larger for more skew
+@return the distribution
+*/
+Zipf makeZipf( int n, double s )
+{
+  Zipf z = { (double *) malloc( n * sizeof( double ) ), n };
+  double total = 0;
+  for ( int i = 0; i < n; i++ ) {
+    total += 1.0 / pow( i + 1, s );
+    z.cdf[ i ] = total;
+  }
+  for ( int i = 0; i < n; i++ )
+    z.cdf[ i ] /= total;
+  return z;
+}
+
+/**
+Draw a rank from the distribution
+@param z the distribution
+@param u a uniform random number in [0, 1)
+@return the rank, with 0 the most popular
+*/
+int nextZipf( Zipf const *z, double u )
+{
+  int lo = 0, hi = z->n - 1;
+  while ( lo < hi ) {
+    int mid = ( lo + hi ) / 2;
+    if ( z->cdf[ mid ] < u )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+Free the memory used by a distribution
+@param z the distribution
+*/
+void freeZipf( Zipf *z )
+{
+  free( z->cdf );
+  z->cdf = NULL;
+}
@@ -0,0 +1,37 @@
+/**
+@file zipf
+@author Ethan Browne, efbrowne
+Zipf-distributed random ranks, for generating skewed workloads where a few
+keys are much more popular than the rest.
+*/
+
+#ifndef ZIPF_H
+#define ZIPF_H
+
+/** Cumulative distribution used to draw Zipf-distributed ranks. */
+typedef struct {
+  /** Probability of drawing a rank less than or equal to each index. */
+  double *cdf;
+
+  /** Number of ranks. */
+  int n;
+} Zipf;
+
+/** Build a Zipf distribution over ranks 0 .. n - 1, where rank i is drawn
+    with probability proportional to 1 / (i + 1)^s.
+    @param n number of ranks.
+    @param s the exponent, larger for more skew.
+    @return the distribution, to be freed with freeZipf(). */
+Zipf makeZipf( int n, double s );
+
+/** Draw a rank from the distribution.
+    @param z the distribution.
+    @param u a uniform random number in [0, 1).
+    @return the rank, with 0 the most popular. */
+int nextZipf( Zipf const *z, double u );
+
+/** Free the memory used by a distribution.
+    @param z the distribution. */
+void freeZipf( Zipf *z );
+
+#endif